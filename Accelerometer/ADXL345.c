@@ -0,0 +1,734 @@
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include <asm/io.h>
+#include "address_map_arm.h"
+#include "ADXL345.h"
+
+/* I2C0 transfer engine and ADXL345 register access used by the accel driver.
+ * Hardware is only touched through readl()/writel() and the kernel's sleep and
+ * jiffies helpers, so the host simulator in sim/ builds this file unchanged
+ * against its register models. */
+
+volatile int *I2C0_ptr;	            // virtual address for I2C
+volatile int *SYSMGR_ptr;           // virtual address for SYSMGR
+
+struct i2c0_stats I2C0_Stats;
+
+// Owner of the I2C0 controller. Every transaction and controller reset runs with
+// it held, so commands from different callers never interleave in DATA_CMD no
+// matter which driver lock (if any) they hold. Sequences of registers that must
+// not be split are the caller's business.
+static DEFINE_MUTEX(i2c0_bus);
+
+// Register access by word offset
+#define I2C0_READ(reg)              readl(I2C0_ptr + (reg))
+#define I2C0_WRITE(reg, value)      writel((value), I2C0_ptr + (reg))
+#define SYSMGR_WRITE(reg, value)    writel((value), SYSMGR_ptr + (reg))
+
+
+void Pinmux_Config(void){
+    // Set up pin muxing (in sysmgr) to connect ADXL345 wires to I2C0
+    SYSMGR_WRITE(SYSMGR_I2C0USEFPGA, 0);
+    SYSMGR_WRITE(SYSMGR_GENERALIO7, 1);
+    SYSMGR_WRITE(SYSMGR_GENERALIO8, 1);
+}
+
+
+// I2C0 DATA_CMD command bits (ORed with the data byte)
+#define I2C0_CMD_READ       0x100
+#define I2C0_CMD_STOP       0x200
+#define I2C0_CMD_RESTART    0x400
+
+// Status bits used by the transfer engine
+#define I2C0_STATUS_TFE             0x04    // TX FIFO empty
+#define I2C0_STATUS_MST_ACTIVITY    0x20    // master state machine busy
+#define I2C0_INTR_TX_ABRT           0x40    // in RAW_INTR_STAT
+
+// Depth of the TX and RX FIFOs of the HPS I2C controllers
+#define I2C0_FIFO_DEPTH     64
+
+// One byte (9 clocks) takes ~23us at 400kb/s. Sleep in these units while the
+// bus is busy and give up on a transfer that has not finished in I2C0_TIMEOUT_MS.
+#define I2C0_BYTE_US        23
+#define I2C0_TIMEOUT_MS     20
+
+
+// Wait (sleeping) until ENABLE_STATUS reports the requested state
+static int I2C0_WaitEnabled(uint32_t enabled){
+    unsigned long deadline = jiffies + msecs_to_jiffies(I2C0_TIMEOUT_MS);
+
+    while((I2C0_READ(I2C0_ENABLE_STATUS)&0x1) != enabled){
+        if (time_after(jiffies, deadline)){
+            printk(KERN_ERR "accel: timed out waiting for I2C0 to %s\n", enabled ? "enable" : "disable");
+            return -ETIMEDOUT;
+        }
+        usleep_range(I2C0_BYTE_US, 4*I2C0_BYTE_US);
+    }
+    return 0;
+}
+
+static int I2C0_Reset(void){
+    int err;
+
+    // Abort any ongoing transmits and disable I2C0.
+    I2C0_WRITE(I2C0_ENABLE, 2);
+
+    // Wait until I2C0 is disabled
+    if ((err = I2C0_WaitEnabled(0)) < 0)
+        return err;
+
+    // Configure the config reg with the desired setting (act as
+    // a master, use 7bit addressing, fast mode (400kb/s)).
+    I2C0_WRITE(I2C0_CON, 0x65);
+
+    // Set target address (disable special commands, use 7bit addressing)
+    I2C0_WRITE(I2C0_TAR, 0x53);
+
+    // Set SCL high/low counts (Assuming default 100MHZ clock input to I2C0 Controller).
+    // The minimum SCL high period is 0.6us, and the minimum SCL low period is 1.3us,
+    // However, the combined period must be 2.5us or greater, so add 0.3us to each.
+    I2C0_WRITE(I2C0_FS_SCL_HCNT, 60 + 30); // 0.6us + 0.3us
+    I2C0_WRITE(I2C0_FS_SCL_LCNT, 130 + 30); // 1.3us + 0.3us
+
+    // The engine polls RAW_INTR_STAT, keep the interrupt line quiet
+    I2C0_WRITE(I2C0_INTR_MASK, 0);
+
+    // Enable the controller
+    I2C0_WRITE(I2C0_ENABLE, 1);
+
+    // Wait until controller is enabled
+    return I2C0_WaitEnabled(1);
+}
+
+int I2C0_Init(void){
+    int err;
+
+    mutex_lock(&i2c0_bus);
+    err = I2C0_Reset();
+    mutex_unlock(&i2c0_bus);
+    return err;
+}
+
+// True once everything queued has left the TX FIFO and the master is idle
+static bool I2C0_Idle(void){
+    uint32_t status = I2C0_READ(I2C0_STATUS);
+
+    return (status & I2C0_STATUS_TFE) && !(status & I2C0_STATUS_MST_ACTIVITY);
+}
+
+// The controller flushed its FIFOs after a NACK or arbitration loss. Clear the
+// abort and drop anything left in the RX FIFO so the next transfer starts clean.
+static int I2C0_Abort(void){
+    uint32_t source = I2C0_READ(I2C0_TX_ABRT_SOURCE);
+
+    (void) I2C0_READ(I2C0_CLR_TX_ABRT);
+    while (I2C0_READ(I2C0_RXFLR) > 0)
+        (void) I2C0_READ(I2C0_DATA_CMD);
+
+    I2C0_Stats.aborts++;
+    printk_ratelimited(KERN_ERR "accel: I2C0 transfer aborted, TX_ABRT_SOURCE 0x%X\n", source);
+    return -EIO;
+}
+
+// Run count identical transactions with the ADXL345 back to back: write tx_len
+// bytes and then read rx_len bytes back, each transaction's reply going to the
+// next rx_len bytes of rx. Every transaction starts with a (RE)START and ends
+// with a STOP, and the next one is queued behind it so the bus does not wait for
+// the CPU in between. Commands are only pushed while the TX FIFO has room, and
+// reads are only requested while the RX FIFO can hold their replies. The caller
+// sleeps while the bus is busy, once per FIFO load rather than per transaction;
+// a run that does not complete within I2C0_TIMEOUT_MS resets the controller.
+// Returns count, or after an abort or timeout the number of transactions whose
+// reply was complete, or the error if there were none. Every outcome is counted
+// in I2C0_Stats. Called with i2c0_bus held.
+static int I2C0_Transfer_Repeat_Locked(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len, int count){
+    unsigned long deadline = jiffies + msecs_to_jiffies(I2C0_TIMEOUT_MS);
+    ktime_t start = ktime_get();
+    int total = tx_len + rx_len;
+    int queued = 0, requested = 0, received = 0;
+    int room, pending, pos, i, err;
+    uint32_t cmd, us;
+
+    while (1){
+        if (I2C0_READ(I2C0_RAW_INTR_STAT) & I2C0_INTR_TX_ABRT){
+            err = I2C0_Abort();
+            return rx_len && received >= rx_len ? received / rx_len : err;
+        }
+
+        // Collect whatever has arrived
+        while (received < rx_len * count && I2C0_READ(I2C0_RXFLR) > 0)
+            rx[received++] = I2C0_READ(I2C0_DATA_CMD);
+
+        // Top up the TX FIFO
+        room = I2C0_FIFO_DEPTH - I2C0_READ(I2C0_TXFLR);
+        while (room > 0 && queued < total * count){
+            pos = queued % total;
+            if (pos < tx_len)
+                cmd = tx[pos];
+            else if (requested - received < I2C0_FIFO_DEPTH)
+                cmd = I2C0_CMD_READ;
+            else
+                break;
+
+            if (pos == 0)
+                cmd |= I2C0_CMD_RESTART;
+            if (pos == total - 1)
+                cmd |= I2C0_CMD_STOP;
+
+            I2C0_WRITE(I2C0_DATA_CMD, cmd);
+            if (pos >= tx_len)
+                requested++;
+            queued++;
+            room--;
+        }
+
+        if (queued == total * count && received == rx_len * count && I2C0_Idle()){
+            // Each transaction is counted with its share of the time
+            us = ktime_us_delta(ktime_get(), start) / count;
+            for (i = 0; i < count; i++)
+                Accel_Hist_Add(&I2C0_Stats.time_us, us);
+            I2C0_Stats.transfers += count;
+            I2C0_Stats.bytes += total * count;
+            return count;
+        }
+
+        if (time_after(jiffies, deadline)){
+            printk_ratelimited(KERN_ERR "accel: I2C0 transfer timed out (%d/%d sent, %d/%d received)\n",
+                queued, total * count, received, rx_len * count);
+            I2C0_Stats.timeouts++;
+            I2C0_Reset();
+            return rx_len && received >= rx_len ? received / rx_len : -ETIMEDOUT;
+        }
+
+        // Sleep for roughly as long as the commands still queued take. A read
+        // waiting in the TX FIFO is also a reply still to come, count it once.
+        pending = I2C0_READ(I2C0_TXFLR);
+        if (pending < requested - received)
+            pending = requested - received;
+        if (pending < 1)
+            pending = 1;
+        usleep_range(pending * I2C0_BYTE_US, pending * I2C0_BYTE_US + 2*I2C0_BYTE_US);
+    }
+}
+
+// A single transaction, 0 or an error
+static int I2C0_Transfer_Locked(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len){
+    int err = I2C0_Transfer_Repeat_Locked(tx, tx_len, rx, rx_len, 1);
+
+    return err < 0 ? err : 0;
+}
+
+int I2C0_Transfer(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len){
+    int err;
+
+    mutex_lock(&i2c0_bus);
+    err = I2C0_Transfer_Locked(tx, tx_len, rx, rx_len);
+    mutex_unlock(&i2c0_bus);
+    return err;
+}
+
+int I2C0_Transfer_Repeat(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len, int count){
+    int done;
+
+    mutex_lock(&i2c0_bus);
+    done = I2C0_Transfer_Repeat_Locked(tx, tx_len, rx, rx_len, count);
+    mutex_unlock(&i2c0_bus);
+    return done;
+}
+
+// Consistent copy of I2C0_Stats, or clear them
+void I2C0_Stats_Get(struct i2c0_stats *stats){
+
+    mutex_lock(&i2c0_bus);
+    *stats = I2C0_Stats;
+    mutex_unlock(&i2c0_bus);
+}
+
+void I2C0_Stats_Reset(void){
+
+    mutex_lock(&i2c0_bus);
+    memset(&I2C0_Stats, 0, sizeof(I2C0_Stats));
+    mutex_unlock(&i2c0_bus);
+}
+
+// Count one duration in a log2 histogram
+void Accel_Hist_Add(struct accel_hist *hist, uint32_t us){
+    int i = fls(us);
+
+    hist->bucket[i < ACCEL_HIST_BUCKETS ? i : ACCEL_HIST_BUCKETS - 1]++;
+    hist->count++;
+    hist->sum_us += us;
+    if (us > hist->max_us)
+        hist->max_us = us;
+}
+
+
+// Shadow of the ADXL345 configuration registers: THRESH_TAP to TAP_AXES, BW_RATE
+// to INT_MAP, DATA_FORMAT and FIFO_CTL. The part never changes them by itself,
+// so once a value is known reads are answered from here and writes of the value
+// already there are skipped. A failed write forgets the register, as it may or
+// may not have reached the part. Kept under i2c0_bus.
+#define ADXL345_REGS        0x40
+
+static uint8_t shadow[ADXL345_REGS];
+static uint64_t shadow_valid;           // one bit per register
+
+static bool ADXL345_Cacheable(uint8_t address){
+
+    return (address >= ADXL345_REG_THRESH_TAP && address <= ADXL345_REG_TAP_AXES) ||
+           (address >= ADXL345_REG_BW_RATE && address <= ADXL345_REG_INT_MAP) ||
+           address == ADXL345_REG_DATA_FORMAT || address == ADXL345_REG_FIFO_CTL;
+}
+
+static bool ADXL345_Shadow_Valid(uint8_t address){
+
+    return address < ADXL345_REGS && (shadow_valid >> address & 1);
+}
+
+static void ADXL345_Shadow_Set(uint8_t address, uint8_t value, bool valid){
+
+    if (!ADXL345_Cacheable(address))
+        return;
+    shadow[address] = value;
+    if (valid)
+        shadow_valid |= 1ULL << address;
+    else
+        shadow_valid &= ~(1ULL << address);
+}
+
+// Forget every shadowed value, e.g. when the part may have been reset
+void ADXL345_Shadow_Reset(void){
+
+    mutex_lock(&i2c0_bus);
+    shadow_valid = 0;
+    mutex_unlock(&i2c0_bus);
+}
+
+// Write len consecutive registers starting at address in one transaction (the
+// register pointer auto-increments). Registers at either end that already hold
+// their value are trimmed off, and if none changed nothing is sent. Only use it
+// on ranges where rewriting an unchanged register has no side effect.
+int ADXL345_REG_WRITE_MULTI(uint8_t address, const uint8_t values[], uint8_t len){
+    uint8_t tx[1 + ADXL345_MAX_BURST];
+    int first = 0, last = len - 1, i;
+    int err = 0;
+
+    if (len > ADXL345_MAX_BURST)
+        return -EINVAL;
+
+    mutex_lock(&i2c0_bus);
+    while (first <= last && ADXL345_Shadow_Valid(address + first) && shadow[address + first] == values[first])
+        first++;
+    while (last >= first && ADXL345_Shadow_Valid(address + last) && shadow[address + last] == values[last])
+        last--;
+    I2C0_Stats.shadow_hits += len - (last - first + 1);
+
+    if (first <= last){
+        tx[0] = address + first;
+        memcpy(&tx[1], &values[first], last - first + 1);
+        err = I2C0_Transfer_Locked(tx, last - first + 2, NULL, 0);
+        for (i = first; i <= last; i++)
+            ADXL345_Shadow_Set(address + i, values[i], err == 0);
+    }
+    mutex_unlock(&i2c0_bus);
+    return err;
+}
+
+int ADXL345_REG_WRITE(uint8_t address, uint8_t value){
+
+    return ADXL345_REG_WRITE_MULTI(address, &value, 1);
+}
+
+int ADXL345_REG_READ(uint8_t address, uint8_t *value){
+    int err = 0;
+
+    mutex_lock(&i2c0_bus);
+    if (ADXL345_Shadow_Valid(address)){
+        *value = shadow[address];
+        I2C0_Stats.shadow_hits++;
+    }
+    else if ((err = I2C0_Transfer_Locked(&address, 1, value, 1)) == 0)
+        ADXL345_Shadow_Set(address, *value, true);
+    mutex_unlock(&i2c0_bus);
+    return err;
+}
+
+// Milli-g per LSB in Q8 for a DATA_FORMAT value. Full resolution is always
+// 3.90625 mg (1000/256), 10 bit mode spreads +-range over 1024 LSBs, so both
+// are exact in Q8 and samples scale with a single multiply.
+int32_t ADXL345_Scale_q8(uint8_t data_format){
+
+    if (data_format & XL345_FULL_RESOLUTION)
+        return 1000;
+    return 1000 << (data_format & 0x03);
+}
+
+int ADXL345_Init(void){
+    // THRESH_ACT, THRESH_INACT, TIME_INACT, ACT_INACT_CTL
+    static const uint8_t act_inact[4] = { 0x04, 0x02, 0x02, 0xFF };
+    int err;
+
+    // +- 16g range, 10 bit resolution
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, ADXL345_INIT_FORMAT)) < 0)
+        return err;
+
+    // Output Data Rate: 12.5 Hz
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, ADXL345_INIT_RATE)) < 0)
+        return err;
+
+    // NOTE: The DATA_READY bit is not reliable. It is updated at a much higher rate than the Data Rate
+    // Use the Activity and Inactivity interrupts.
+    //----- Enabling interrupts -----//
+    // activity threshold, inactivity threshold, time for inactivity, and AC
+    // coupling for both thresholds, in one burst
+    if ((err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_THRESH_ACT, act_inact, sizeof(act_inact))) < 0)
+        return err;
+    //ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE, XL345_SINGLETAP | XL345_DOUBLETAP);	//enable interrupts XL345_ACTIVITY | XL345_INACTIVITY
+    //-------------------------------//
+
+    // stop measure
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY)) < 0)
+        return err;
+
+    // start measure
+    return ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE);
+}
+
+bool ADXL345_WasActivityUpdated(void){
+	bool bReady = false;
+    uint8_t data8;
+
+    if (ADXL345_REG_READ(ADXL345_REG_INT_SOURCE,&data8) < 0)
+        return false;
+    if (data8 & XL345_ACTIVITY)
+        bReady = true;
+
+    return bReady;
+}
+
+// Return true if there is new data (checks DATA_READY bit).
+bool ADXL345_IsDataReady(void){
+    bool bReady = false;
+    uint8_t data8;
+
+    if (ADXL345_REG_READ(ADXL345_REG_INT_SOURCE,&data8) < 0)
+        return false;
+    if (data8 & XL345_DATAREADY)
+        bReady = true;
+    return bReady;
+}
+
+
+// Read multiple consecutive internal registers
+int ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len){
+
+    return I2C0_Transfer(&address, 1, values, len);
+}
+
+// Read acceleration data of all three axes
+int ADXL345_XYZ_Read(int16_t szData16[3]){
+    uint8_t szData8[6];
+    int err;
+
+    if ((err = ADXL345_REG_MULTI_READ(0x32, (uint8_t *)&szData8, sizeof(szData8))) < 0)
+        return err;
+
+    szData16[0] = (szData8[1] << 8) | szData8[0];
+    szData16[1] = (szData8[3] << 8) | szData8[2];
+    szData16[2] = (szData8[5] << 8) | szData8[4];
+    return 0;
+}
+
+// Drain up to max entries from the FIFO into xyz. INT_SOURCE is read first so the
+// caller sees OVERRUN/WATERMARK for this batch, then FIFO_STATUS says how many
+// entries are waiting. Each entry needs its own 6 byte read of DATAX0..DATAZ1,
+// the part pops the FIFO at its STOP, but they all go out as one burst so the
+// drain costs bus time and not a sleep per entry. The bytes land in xyz itself
+// and are put together in place. Returns the number of samples read. An error
+// part way through returns what was read so far; the error then shows up on
+// the next call.
+int ADXL345_FIFO_Read(int16_t xyz[][3], int max, uint8_t *int_source){
+    uint8_t address = ADXL345_REG_DATAX0;
+    uint8_t fifo_status, data[6];
+    int entries, n, i;
+    int err;
+
+    if ((err = ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, int_source)) < 0 ||
+        (err = ADXL345_REG_READ(ADXL345_REG_FIFO_STATUS, &fifo_status)) < 0)
+        return err;
+
+    entries = fifo_status & XL345_FIFO_ENTRIES_MASK;
+    if (entries > max)
+        entries = max;
+    if (entries == 0)
+        return 0;
+
+    if ((n = I2C0_Transfer_Repeat(&address, 1, (uint8_t *) xyz, sizeof(xyz[0]), entries)) < 0)
+        return n;
+    for (i = 0; i < n; i++){
+        memcpy(data, xyz[i], sizeof(data));
+        xyz[i][0] = (data[1] << 8) | data[0];
+        xyz[i][1] = (data[3] << 8) | data[2];
+        xyz[i][2] = (data[5] << 8) | data[4];
+    }
+    return n;
+}
+
+int ADXL345_TAP(void)
+{
+    // DUR, LATENT, WINDOW
+    static const uint8_t timing[3] = { 0x1F, 0x0F, 0xEF };
+    int err;
+
+    //Tap threshold set at 3g
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_THRESH_TAP, 0x2F)) < 0)
+        return err;
+
+    //Tap duration 0.02s, latency 0.02s and window 0.3s in one burst
+    if ((err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_DUR, timing, sizeof(timing))) < 0)
+        return err;
+
+    //Enable tap in axes
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_TAP_AXES, 0x1)) < 0)
+        return err;
+
+
+    return ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE, XL345_SINGLETAP | XL345_DOUBLETAP);
+}
+
+// Call after ADXL345_TAP(), the tap interrupts stay enabled
+int ADXL345_FreeFall(void)
+{
+    // THRESH_FF, TIME_FF
+    static const uint8_t freefall[2] = { 0x07, 0x14 };
+    int err;
+
+    //Freefall threshold 437.5 mg on all axes, time 0.1s
+    if ((err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_THRESH_FF, freefall, sizeof(freefall))) < 0)
+        return err;
+
+    return ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE, XL345_SINGLETAP | XL345_DOUBLETAP | XL345_FREEFALL);
+}
+
+// Length of one output data period in microseconds for a BW_RATE code
+// (3200 Hz for 0x0F, halving with every step down)
+unsigned int ADXL345_Period_us(uint8_t rate){
+
+    return (5000 << (XL345_RATE_3200 - (rate & 0x0F))) / 16;
+}
+
+// Same in nanoseconds, exact for every rate
+uint64_t ADXL345_Period_ns(uint8_t rate){
+
+    return 312500ULL << (XL345_RATE_3200 - (rate & 0x0F));
+}
+
+void ADXL345_Clock_Reset(struct adxl345_clock *clock){
+
+    clock->valid = false;
+    clock->last_ns = 0;
+}
+
+// Conversion time of the first of raw samples drained from the FIFO in stream
+// mode; the rest follow clock->period_ns apart. start_ns is when the drain
+// started (before FIFO_STATUS was read), so the newest entry was converted in
+// the period before it and is put in the middle of that period. The part's
+// clock is only good to a few percent, so once ADXL345_CLOCK_SETTLE samples
+// have been seen the period is measured from the first batch to this one and
+// the dates follow the line between the two. Scheduling delays do not move
+// them: however late the drain, the newest entry is still within a period of
+// it, so each date is within about half a period of the conversion. A date is
+// never earlier than the one before it, also across an overrun, a rate change
+// or a batch more than two periods off the line, which start the line over.
+int64_t ADXL345_Clock_Batch(struct adxl345_clock *clock, int64_t start_ns, int raw, bool overrun, uint8_t rate){
+    int64_t nominal = ADXL345_Period_ns(rate);
+    int64_t newest = start_ns - nominal / 2;
+    int64_t period, error, first;
+    uint64_t last;
+
+    if (raw <= 0)
+        return newest;
+
+    if (clock->valid && !overrun && clock->nominal_ns == nominal){
+        last = clock->count + raw - 1;
+        error = newest - (clock->first_ns + (int64_t) last * clock->period_ns);
+        if (error > 2 * nominal || error < -2 * nominal)
+            clock->valid = false;
+        else if (last >= ADXL345_CLOCK_SETTLE){
+            period = div64_s64(newest - clock->first_ns, last);
+            if (period > nominal - nominal / 20 && period < nominal + nominal / 20)
+                clock->period_ns = period;
+        }
+    }
+
+    if (!clock->valid || overrun || clock->nominal_ns != nominal){
+        clock->valid = true;
+        clock->nominal_ns = nominal;
+        clock->period_ns = nominal;
+        clock->first_ns = newest - (raw - 1) * nominal;
+        clock->count = 0;
+    }
+
+    first = clock->first_ns + (int64_t) clock->count * clock->period_ns;
+    if (first <= clock->last_ns)
+        first = clock->last_ns + 1;
+    clock->last_ns = first + (raw - 1) * clock->period_ns;
+    clock->count += raw;
+    return first;
+}
+
+// Average `samples` readings at 100 Hz after dropping the first `skip`. Called
+// with lock, the caller's lock over the ADXL345 configuration, held; it is
+// dropped while waiting for the next sample. *done, if given, is updated after
+// every sample so progress can be followed from elsewhere.
+int ADXL345_Sample_Average(struct mutex *lock, int skip, int samples, int16_t average[3], int *done){
+    int32_t sum[3] = { 0, 0, 0 };
+    int16_t XYZ[3];
+    uint8_t int_source;
+    unsigned long deadline;
+    int i = 0;
+    int err;
+
+    // A new sample is due every 10 ms, so sleep for most of a period between checks
+    deadline = jiffies + msecs_to_jiffies(ADXL345_SAMPLE_TIMEOUT_MS);
+    while (i < skip + samples){
+        mutex_unlock(lock);
+        usleep_range(i ? 9000 : 1000, 10000);
+        mutex_lock(lock);
+
+		// Note: use DATA_READY here, can't use ACTIVITY because board is stationary.
+        if ((err = ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &int_source)) < 0)
+            return err;
+        if (int_source & XL345_DATAREADY){
+            if ((err = ADXL345_XYZ_Read(XYZ)) < 0)
+                return err;
+            if (i++ >= skip){
+                sum[0] += XYZ[0];
+                sum[1] += XYZ[1];
+                sum[2] += XYZ[2];
+                if (done)
+                    WRITE_ONCE(*done, i - skip);
+            }
+            deadline = jiffies + msecs_to_jiffies(ADXL345_SAMPLE_TIMEOUT_MS);
+        }
+        else if (time_after(jiffies, deadline))
+            return -ETIMEDOUT;
+    }
+    average[0] = ROUNDED_DIVISION(sum[0], samples);
+    average[1] = ROUNDED_DIVISION(sum[1], samples);
+    average[2] = ROUNDED_DIVISION(sum[2], samples);
+    return 0;
+}
+
+// Average `samples` readings taken at 100 Hz and program OFSX/OFSY/OFSZ so that a
+// board lying flat reads (0, 0, 1g); ofs gets the values written. lock is taken
+// for register accesses and dropped while waiting for the next sample, and
+// *done is updated after every sample (ADXL345_Sample_Average()). The rate and
+// data format are put back as they were.
+int ADXL345_Calibrate(struct mutex *lock, int samples, int *done, int8_t ofs[3]){
+
+    int16_t average[3];
+    int8_t offset_x;
+    int8_t offset_y;
+    int8_t offset_z;
+    uint8_t saved_bw;
+    uint8_t saved_dataformat;
+    int err;
+
+    mutex_lock(lock);
+
+    // stop measure
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY)) < 0)
+        goto out_unlock;
+
+    // Get current offsets
+    if ((err = ADXL345_REG_READ(ADXL345_REG_OFSX, (uint8_t *)&offset_x)) < 0 ||
+        (err = ADXL345_REG_READ(ADXL345_REG_OFSY, (uint8_t *)&offset_y)) < 0 ||
+        (err = ADXL345_REG_READ(ADXL345_REG_OFSZ, (uint8_t *)&offset_z)) < 0)
+        goto out_unlock;
+
+    // Use 100 hz rate for calibration. Save the current rate.
+    if ((err = ADXL345_REG_READ(ADXL345_REG_BW_RATE, &saved_bw)) < 0)
+        goto out_unlock;
+
+    // Use 16g range, full resolution. Save the current format.
+    if ((err = ADXL345_REG_READ(ADXL345_REG_DATA_FORMAT, &saved_dataformat)) < 0)
+        goto out_unlock;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_100)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE)) < 0)   // start measure
+        goto out_restore;
+
+    // Get the average x,y,z accelerations over the samples (LSB 3.9 mg)
+    if ((err = ADXL345_Sample_Average(lock, 0, samples, average, done)) < 0)
+        goto out_restore;
+
+    // stop measure
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY)) < 0)
+        goto out_restore;
+
+    // Calculate the offsets (LSB 15.6 mg)
+    ofs[0] = offset_x + ROUNDED_DIVISION(0-average[0], 4);
+    ofs[1] = offset_y + ROUNDED_DIVISION(0-average[1], 4);
+    ofs[2] = offset_z + ROUNDED_DIVISION(256-average[2], 4);
+
+    // Set the offset registers
+    err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_OFSX, (uint8_t *) ofs, 3);
+
+out_restore:
+    // Restore original bw rate and data format, and start measure
+    if (ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, saved_bw) < 0 ||
+        ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, saved_dataformat) < 0 ||
+        ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE) < 0)
+        printk(KERN_ERR "accel: could not restore settings after calibration\n");
+out_unlock:
+    mutex_unlock(lock);
+    return err;
+}
+
+// Allowed SELF_TEST deflection in LSB of 3.9 mg: the datasheet limits for
+// VS = 2.5 V scaled by 1.77 (X, Y) and 1.47 (Z) for the 3.3 V supply of the board
+static const int16_t test_min[3] = {  89, -955,  110 };
+static const int16_t test_max[3] = { 955,  -89, 1286 };
+
+// Self-test as the datasheet describes it: at 100 Hz, +-16 g full resolution,
+// the average with SELF_TEST set minus the average without, into delta. Called
+// with lock held, see ADXL345_Sample_Average(). Leaves the part measuring at
+// 100 Hz, +-16 g full resolution with SELF_TEST clear; the caller puts its
+// own settings back.
+int ADXL345_Self_Test_Delta(struct mutex *lock, int16_t delta[3]){
+    int16_t off[3], on[3];
+    int i, err;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_100)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE)) < 0 ||
+        (err = ADXL345_Sample_Average(lock, ADXL345_TEST_SETTLE, ADXL345_TEST_SAMPLES, off, NULL)) < 0)
+        return err;
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION | XL345_SELFTEST)) < 0 ||
+        (err = ADXL345_Sample_Average(lock, ADXL345_TEST_SETTLE, ADXL345_TEST_SAMPLES, on, NULL)) < 0)
+        return err;
+
+    for (i = 0; i < 3; i++)
+        delta[i] = on[i] - off[i];
+    return ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION);
+}
+
+// Whether a self-test deflection is within the datasheet limits on every axis
+bool ADXL345_Self_Test_Pass(const int16_t delta[3]){
+    int i;
+
+    for (i = 0; i < 3; i++)
+        if (delta[i] < test_min[i] || delta[i] > test_max[i])
+            return false;
+    return true;
+}
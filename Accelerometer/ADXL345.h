@@ -20,6 +20,7 @@
 #define XL345_RATE__39        0x02
 #define XL345_RATE__195       0x01
 #define XL345_RATE__098       0x00
+#define XL345_LOW_POWER       0x10  // reduced power, 12.5 Hz to 400 Hz only
 
 /* Bit values in DATA_FORMAT                                            */
 
@@ -51,6 +52,18 @@
 #define XL345_SINGLETAP            0x40
 #define XL345_DATAREADY            0x80
 
+/* Bit values in FIFO_CTL                                              */
+#define XL345_FIFO_MODE_BYPASS     0x00
+#define XL345_FIFO_MODE_FIFO       0x40
+#define XL345_FIFO_MODE_STREAM     0x80
+#define XL345_FIFO_MODE_TRIGGER    0xc0
+#define XL345_FIFO_SAMPLES_MASK    0x1f
+
+/* Bit values in FIFO_STATUS                                            */
+#define XL345_FIFO_TRIG            0x80
+#define XL345_FIFO_ENTRIES_MASK    0x3f
+#define XL345_FIFO_DEPTH           32
+
 /* Bit values in POWER_CTL                                              */
 #define XL345_WAKEUP_8HZ           0x00
 #define XL345_WAKEUP_4HZ           0x01
@@ -68,6 +81,7 @@
 #define ADXL345_REG_POWER_CTL   	0x2D
 #define ADXL345_REG_DATA_FORMAT 	0x31
 #define ADXL345_REG_FIFO_CTL    	0x38
+#define ADXL345_REG_FIFO_STATUS 	0x39  // read only
 #define ADXL345_REG_BW_RATE     	0x2C
 #define ADXL345_REG_INT_ENABLE  	0x2E  // default value: 0x00
 #define ADXL345_REG_INT_MAP     	0x2F  // default value: 0x00
@@ -89,6 +103,8 @@
 #define ADXL345_REG_THRESH_INACT	0x25
 #define ADXL345_REG_TIME_INACT		0x26
 #define ADXL345_REG_ACT_INACT_CTL	0x27
+#define ADXL345_REG_THRESH_FF		0x28  // 62.5 mg per LSB
+#define ADXL345_REG_TIME_FF			0x29  // 5 ms per LSB
 #define ADXL345_REG_TAP_AXES        0x2A
 
 //// I2C0 Controller Registers
@@ -149,23 +165,98 @@
 //
 // Rounded division macro
 #define ROUNDED_DIVISION(n, d) (((n < 0) ^ (d < 0)) ? ((n - d/2)/d) : ((n + d/2)/d))
-//
-//// ADXL345 Functions
-//void ADXL345_Init();
-//void ADXL345_Calibrate();
-//bool ADXL345_IsDataReady();
-//bool ADXL345_WasActivityUpdated();
-//void ADXL345_XYZ_Read(int16_t szData16[3]);
-//void ADXL345_IdRead(uint8_t *pId);
-//void ADXL345_REG_READ(uint8_t address, uint8_t *value);
-//void ADXL345_REG_WRITE(uint8_t address, uint8_t value);
-//void ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len);
-//
-//// I2C0 Functions
-//void I2C0_Init();
-//void I2C0_Enable_FPGA_Access();
-//
-//// Pinmux Functions
-//void Pinmux_Config();
+
+// State left by ADXL345_Init(): +-16g, 10 bit, 12.5 Hz
+#define ADXL345_INIT_FORMAT     (XL345_RANGE_16G | XL345_10BIT)
+#define ADXL345_INIT_RATE       XL345_RATE_12_5
+
+// Mapped register blocks (ADXL345.c), set up by the driver with ioremap
+extern volatile int *I2C0_ptr;
+extern volatile int *SYSMGR_ptr;
+
+// Longest register burst ADXL345_REG_WRITE_MULTI() takes
+#define ADXL345_MAX_BURST       8
+
+// ADXL345 Functions (ADXL345.c), negative errno on a failed transfer. Reads and
+// writes of configuration registers go through a shadow copy (see ADXL345.c).
+int ADXL345_Init(void);
+int ADXL345_TAP(void);
+int ADXL345_FreeFall(void);
+bool ADXL345_IsDataReady(void);
+bool ADXL345_WasActivityUpdated(void);
+int ADXL345_XYZ_Read(int16_t szData16[3]);
+int ADXL345_FIFO_Read(int16_t xyz[][3], int max, uint8_t *int_source);
+int ADXL345_REG_READ(uint8_t address, uint8_t *value);
+int ADXL345_REG_WRITE(uint8_t address, uint8_t value);
+int ADXL345_REG_WRITE_MULTI(uint8_t address, const uint8_t values[], uint8_t len);
+void ADXL345_Shadow_Reset(void);
+int ADXL345_REG_MULTI_READ(uint8_t address, uint8_t values[], uint8_t len);
+int32_t ADXL345_Scale_q8(uint8_t data_format);
+unsigned int ADXL345_Period_us(uint8_t rate);
+uint64_t ADXL345_Period_ns(uint8_t rate);
+
+// Sample clock for stream mode FIFO batches (ADXL345_Clock_Batch), times in
+// CLOCK_MONOTONIC nanoseconds
+#define ADXL345_CLOCK_SETTLE    32      // samples before the period is measured
+
+struct adxl345_clock {
+    bool valid;
+    int64_t first_ns;           // conversion time of the first sample since the restart
+    uint64_t count;             // samples dated since
+    int64_t last_ns;            // last date handed out
+    int64_t period_ns;          // period measured on the stream
+    int64_t nominal_ns;         // period set in BW_RATE
+};
+
+void ADXL345_Clock_Reset(struct adxl345_clock *clock);
+int64_t ADXL345_Clock_Batch(struct adxl345_clock *clock, int64_t start_ns, int raw, bool overrun, uint8_t rate);
+
+// Calibration and self-test (ADXL345.c). They take 100 Hz samples with the
+// caller's lock over the ADXL345 configuration held, and drop it between samples.
+#define ADXL345_SAMPLE_TIMEOUT_MS 100   // longest wait for a DATA_READY sample
+#define ADXL345_TEST_SAMPLES    32      // samples averaged with SELF_TEST off and on
+#define ADXL345_TEST_SETTLE     4       // samples dropped after SELF_TEST changes
+
+struct mutex;
+
+int ADXL345_Sample_Average(struct mutex *lock, int skip, int samples, int16_t average[3], int *done);
+int ADXL345_Calibrate(struct mutex *lock, int samples, int *done, int8_t ofs[3]);
+int ADXL345_Self_Test_Delta(struct mutex *lock, int16_t delta[3]);
+bool ADXL345_Self_Test_Pass(const int16_t delta[3]);
+
+// I2C0 Functions
+int I2C0_Init(void);
+int I2C0_Transfer(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len);
+int I2C0_Transfer_Repeat(const uint8_t *tx, int tx_len, uint8_t *rx, int rx_len, int count);
+
+// Pinmux Functions
+void Pinmux_Config(void);
+
+// Log2 histogram of durations: bucket[0] counts values under 1 us, bucket[i]
+// values under 2^i us and the last bucket everything longer
+#define ACCEL_HIST_BUCKETS      16
+
+struct accel_hist {
+    uint32_t bucket[ACCEL_HIST_BUCKETS];
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+};
+
+void Accel_Hist_Add(struct accel_hist *hist, uint32_t us);
+
+// Kept by I2C0_Transfer() under the bus lock, read them with I2C0_Stats_Get()
+struct i2c0_stats {
+    uint32_t transfers;         // completed transfers
+    uint32_t aborts;            // NACK or arbitration loss (-EIO)
+    uint32_t timeouts;          // bus did not finish in time (-ETIMEDOUT)
+    uint64_t bytes;             // bytes written and read by completed transfers
+    uint32_t shadow_hits;       // register reads and writes that needed no transfer
+    struct accel_hist time_us;  // duration of completed transfers
+};
+extern struct i2c0_stats I2C0_Stats;
+
+void I2C0_Stats_Get(struct i2c0_stats *stats);
+void I2C0_Stats_Reset(void);
 
 #endif /*ACCELEROMETER_ADXL345_SPI_H_*/
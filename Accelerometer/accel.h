@@ -0,0 +1,140 @@
+#ifndef ACCELEROMETER_ACCEL_H_
+#define ACCELEROMETER_ACCEL_H_
+
+/* Interface shared between the accel driver and user-space programs.
+ *
+ * Sample ring: after "capture on" is written to /dev/accel, the driver drains the
+ * ADXL345 FIFO into one ring of struct accel_sample that every reader shares.
+ * "capture auto" does the same only while the board moves: the first sample of
+ * each segment has XL345_ACTIVITY (0x10) in int_source, the last one
+ * XL345_INACTIVITY (0x08).
+ *
+ * read() on /dev/accel then returns text lines from the ring, each open file
+ * keeping its own cursor. A line is INT_SOURCE (hex), raw X Y Z, X Y Z in milli-g
+ * and the conversion time in seconds on CLOCK_MONOTONIC. A reader that falls
+ * more than a ring behind skips to the oldest sample still held and the number
+ * of lost samples is added to its overrun count (ACCEL_IOC_READER_STATS).
+ *
+ * Alternatively mmap() /dev/accel (offset 0) to read samples without copying.
+ * The driver only publishes head and overwrites the oldest slot when the ring is
+ * full, so any number of processes can map it, each with a private cursor.
+ * poll() is readable while the file's own cursor is behind head, so a mapping
+ * reader hands its cursor back with ACCEL_IOC_CURSOR before it waits:
+ *
+ *   struct accel_ring *ring = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+ *   struct accel_sample *slot = (void *) ring + ring->data_offset, s;
+ *   uint32_t cursor = ring->head;
+ *   while (1) {
+ *       uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+ *       if (head - cursor >= ring->size)              // lapped: skip ahead
+ *           cursor = head - ring->size + 1;
+ *       while (cursor != head) {
+ *           s = slot[cursor & (ring->size - 1)];
+ *           __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *           if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - cursor >= ring->size)
+ *               break;                                // overwritten while copying
+ *           process(&s);
+ *           cursor++;
+ *       }
+ *       ioctl(fd, ACCEL_IOC_CURSOR, &cursor);
+ *       poll(fd) for POLLIN;
+ *   }
+ *
+ * Filtered stream: the "filter" and "decimate" commands set up a fixed-point
+ * pipeline (high-pass, low-pass, moving average, decimation) that runs on every
+ * captured sample. After ioctl(fd, ACCEL_IOC_FILTERED) read() on that file
+ * returns lines from its output instead of the ring, with the same format: the
+ * milli-g columns are filtered, raw X Y Z are those of the FIFO entry the sample
+ * was kept from. The mmap ring, other files and the input device always get
+ * every sample unfiltered.
+ *
+ * Events: while capturing, the driver also tracks pitch, roll and which face of
+ * the board points up, and queues a struct accel_event only when something
+ * changes (orientation, tilt by more than the "tilt" step, freefall, taps).
+ * After ioctl(fd, ACCEL_IOC_EVENTS) read() on that file returns whole events
+ * instead of text lines, and poll() waits for the next one. A reader that falls
+ * more than ACCEL_EVENT_QUEUE events behind loses the oldest ones. The current
+ * orientation is also in /sys/class/accel/accel/orientation.
+ *
+ * Input device: "ADXL345 accelerometer" reports every captured sample as one
+ * evdev frame, ABS_X/ABS_Y/ABS_Z in milli-g (resolution 1000 per g), with
+ * BTN_0 and BTN_1 pressed and released for single and double taps. From Linux
+ * 5.4 on the events carry the sample's time_ns as their timestamp. Opening its
+ * /dev/input/event* node starts "capture on" if capture is off.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+#define ACCEL_RING_VERSION 4
+
+// Milli-g values are fixed point with 8 fraction bits: divide by 256 (or shift
+// right by ACCEL_MG_SHIFT) for whole milli-g. The scale depends on the range and
+// resolution set with "format", the raw values are kept for reference.
+#define ACCEL_MG_SHIFT 8
+
+// time_ns is when the ADXL345 converted the sample, on CLOCK_MONOTONIC, so it
+// compares directly with clock_gettime(CLOCK_MONOTONIC) and other sensors'
+// kernel timestamps. FIFO entries are dated back from the drain one sample
+// period apart, with the period measured on the stream (period_ns); a decimated
+// sample keeps the time of the FIFO entry it came from.
+struct accel_sample {
+    int64_t time_ns;            // conversion time, CLOCK_MONOTONIC
+    int32_t mg[3];              // X, Y, Z in milli-g, Q8, filtered in the filtered stream
+    int16_t xyz[3];             // raw X, Y, Z in the current DATA_FORMAT
+    uint16_t int_source;        // INT_SOURCE bits seen with this FIFO batch
+    uint32_t period_ns;         // sample period time_ns was dated with
+};
+
+struct accel_ring {
+    uint32_t version;           // ACCEL_RING_VERSION
+    uint32_t size;              // number of sample slots, a power of two
+    uint32_t sample_size;       // sizeof(struct accel_sample)
+    uint32_t data_offset;       // offset of slot 0 from the start of the mapping
+    uint32_t head;              // producer index, free running, written by the driver
+};
+
+// Cursor and overrun count of the calling open file (read() interface)
+struct accel_reader_stats {
+    uint32_t cursor;            // index of the next sample read() returns
+    uint32_t head;              // current producer index
+    uint32_t overruns;          // samples lost because the reader fell behind
+};
+
+// Which face of the board points up
+#define ACCEL_ORIENT_UNKNOWN    0
+#define ACCEL_ORIENT_X_UP       1
+#define ACCEL_ORIENT_X_DOWN     2
+#define ACCEL_ORIENT_Y_UP       3
+#define ACCEL_ORIENT_Y_DOWN     4
+#define ACCEL_ORIENT_Z_UP       5   // lying flat, components up
+#define ACCEL_ORIENT_Z_DOWN     6
+
+#define ACCEL_EV_ORIENT         1   // orientation changed
+#define ACCEL_EV_TILT           2   // pitch or roll moved by the tilt step
+#define ACCEL_EV_FREEFALL       3
+#define ACCEL_EV_TAP            4
+#define ACCEL_EV_DOUBLE_TAP     5
+
+#define ACCEL_EVENT_QUEUE       64
+
+struct accel_event {
+    uint16_t type;              // ACCEL_EV_*
+    uint16_t orientation;       // ACCEL_ORIENT_* after this event
+    int16_t pitch;              // hundredths of a degree, X axis above the horizon
+    int16_t roll;               // hundredths of a degree about X, 0 lying flat
+    uint32_t seq;               // ring head when the event was raised
+};
+
+#define ACCEL_IOC_MAGIC 'a'
+#define ACCEL_IOC_READER_STATS _IOR(ACCEL_IOC_MAGIC, 1, struct accel_reader_stats)
+#define ACCEL_IOC_EVENTS _IO(ACCEL_IOC_MAGIC, 2)     // read() returns struct accel_event
+#define ACCEL_IOC_FILTERED _IO(ACCEL_IOC_MAGIC, 3)   // read() returns the filtered stream
+#define ACCEL_IOC_CURSOR _IOW(ACCEL_IOC_MAGIC, 4, uint32_t)   // set this file's cursor
+
+#endif /*ACCELEROMETER_ACCEL_H_*/
@@ -0,0 +1,1742 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/input.h>
+#include <linux/seqlock.h>
+#include <linux/math64.h>
+#include <linux/version.h>
+#include <asm/io.h>
+#include <asm/uaccess.h>
+#include "address_map_arm.h"
+#include "ADXL345.h"
+#include "accel.h"
+#include "orient.h"
+#include "capture.h"
+
+ // Declare global variables
+int accel_buffer;
+int r = 0;
+int32_t mg_per_lsb_q8 = 8000;        // milli-g per LSB in Q8 (31.25 mg at 16g, 10 bit)
+
+// Owns the ADXL345 configuration and multi-register sequences (file operations,
+// calibrate_work, the capture thread). Single bus transactions are serialized
+// by ADXL345.c on their own; the latest sample is published under latest_lock.
+static DEFINE_MUTEX(accel_lock);
+
+// Calibration runs in the background; progress is reported through sysfs
+enum cal_states { CAL_IDLE, CAL_RUNNING, CAL_DONE, CAL_FAILED };
+static enum cal_states cal_state = CAL_IDLE;
+static int cal_done, cal_total, cal_err;
+static void calibrate_work_fn(struct work_struct *work);
+static DECLARE_WORK(calibrate_work, calibrate_work_fn);
+
+// "selftest" runs the same way, with the same states. The sensor belongs to
+// whichever of the two jobs is running until it is finished.
+static enum cal_states test_state = CAL_IDLE;
+static int test_step, test_err;
+static void selftest_work_fn(struct work_struct *work);
+static DECLARE_WORK(selftest_work, selftest_work_fn);
+
+static bool sensor_busy(void){
+
+    return READ_ONCE(cal_state) == CAL_RUNNING || READ_ONCE(test_state) == CAL_RUNNING;
+}
+
+#define CAL_MAX_SAMPLES 1024
+
+// Self-test (ADXL345_Self_Test_Delta()), then a throughput benchmark: back to
+// back ADXL345_XYZ_Read() calls, and FIFO draining like the capture thread
+// does at every rate from 12.5 Hz to 3200 Hz.
+#define BENCH_MS 500                    // time spent on each measurement
+#define BENCH_RATES (XL345_RATE_3200 - XL345_RATE_12_5 + 1)
+#define TEST_STEPS (2 + BENCH_RATES)
+
+static struct {
+    int16_t delta[3];                       // SELF_TEST on minus off
+    bool pass;
+    uint32_t reads;                         // ADXL345_XYZ_Read() calls per second
+    uint32_t read_min_us, read_avg_us, read_max_us;
+    struct {
+        uint32_t centisps;                  // samples drained per second, hundredths
+        uint32_t overruns;                  // batches that came with XL345_OVERRUN
+        uint32_t transfers;                 // I2C transfers per second
+        uint32_t transfer_us;               // their average duration
+    } rate[BENCH_RATES];                    // by BW_RATE code from XL345_RATE_12_5
+} test;
+
+static int cal_samples = 32;
+module_param(cal_samples, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(cal_samples, "Number of samples averaged by \"calibrate\" (default 32)");
+
+// Offsets from an earlier calibration. When given, they are written at load time
+// instead of re-measuring, e.g. insmod accel.ko offsets=0,-2,5
+static int offsets[3];
+static int num_offsets;
+module_param_array(offsets, int, &num_offsets, S_IRUGO);
+MODULE_PARM_DESC(offsets, "OFSX,OFSY,OFSZ offset registers to restore (LSB 15.6 mg)");
+
+// Sample ring shared with user space through mmap (layout in accel.h)
+static int ring_samples = 4096;
+module_param(ring_samples, int, S_IRUGO);
+MODULE_PARM_DESC(ring_samples, "Number of samples in the mmap ring, rounded up to a power of two (default 4096)");
+
+static struct accel_ring *ring;
+static size_t ring_bytes;
+
+// The driver's own view of the mapped ring: data, size and producer index. The
+// header page is mapped into user space, so its size and head are only ever
+// written, never read back or used as an index.
+static struct capture_ring raw_ring;
+
+// Filtered stream: what the "filter" and "decimate" pipeline makes of the
+// captured samples, in a second ring of as many slots that is not mapped.
+// Files switched over with ACCEL_IOC_FILTERED read it instead of the raw ring,
+// so the mmap ring, other read() callers and the input device keep every
+// sample as converted.
+static struct capture_ring filtered_ring;
+static DECLARE_WAIT_QUEUE_HEAD(ring_wait);
+
+// Per open file state: each reader has its own cursor into the shared ring
+#define MSG_SIZE 80
+
+struct accel_reader {
+    uint32_t cursor;                // next ring index to return
+    uint32_t overruns;              // samples skipped because the reader fell behind
+    bool events;                    // ACCEL_IOC_EVENTS: read() returns struct accel_event
+    bool filtered;                  // ACCEL_IOC_FILTERED: cursor is into the filtered stream
+    uint32_t event_cursor;          // next event_ring index to return
+    char msg[MSG_SIZE];             // formatted line being returned
+    int msg_len, msg_pos;
+};
+
+// Latest sample, from the capture thread or a one-shot read. Writers publish it
+// under the seqlock and readers copy it without taking any lock, retrying if a
+// write got in between, so a reader never holds up acquisition. read() reuses
+// it for one output data period so concurrent readers do not each start an
+// I2C transaction.
+static DEFINE_SEQLOCK(latest_lock);
+static struct accel_sample latest;
+
+// Thread draining the ADXL345 FIFO into the ring while "capture on"
+static struct task_struct *capture_task;
+static uint8_t bw_rate = XL345_RATE_12_5;      // last value written to BW_RATE
+static struct adxl345_clock sample_clock;       // dates the FIFO batches, under accel_lock
+
+// Output data rates selectable in BW_RATE, in hundredths of a Hz
+static const struct {
+    uint32_t centihz;
+    uint8_t code;
+} rate_table[] = {
+    { 320000, XL345_RATE_3200 },
+    { 160000, XL345_RATE_1600 },
+    {  80000, XL345_RATE_800 },
+    {  40000, XL345_RATE_400 },
+    {  20000, XL345_RATE_200 },
+    {  10000, XL345_RATE_100 },
+    {   5000, XL345_RATE_50 },
+    {   2500, XL345_RATE_25 },
+    {   1250, XL345_RATE_12_5 },
+    {    625, XL345_RATE_6_25 },
+    {    313, XL345_RATE_3_125 },
+    {    156, XL345_RATE_1_563 },
+    {     78, XL345_RATE__782 },
+    {     39, XL345_RATE__39 },
+    {     20, XL345_RATE__195 },
+    {     10, XL345_RATE__098 },
+};
+
+// Above 400 Hz every sample needs the FIFO (read() in bypass mode only sees the latest)
+#define RATE_FIFO_ONLY_CENTIHZ 40000
+
+// Filter pipeline settings and state (capture.c)
+static struct accel_filter filter = { .avg_len = 1, .avg_recip = 1 << 16, .decimate = 1 };
+
+// Acquisition statistics shown in sysfs ("stats" and "latency"). I2C0_Stats is
+// kept by the bus code under its own lock, the rest under stats_lock.
+static DEFINE_SPINLOCK(stats_lock);
+static struct {
+    uint32_t samples;                       // samples drained from the FIFO
+    uint32_t fifo_overruns;                 // FIFO batches that came with XL345_OVERRUN
+    uint32_t read_errors;                   // failed capture batches and one-shot reads
+    uint32_t reads;                         // one-shot reads (not capturing)
+    uint32_t cached_reads;                  // ... answered without touching the bus
+    uint32_t sleeps;                        // "capture auto" went idle on INACTIVITY
+    uint32_t wakeups;                       // ... and resumed on ACTIVITY
+    struct accel_hist latency_us;           // conversion to ring publish
+    struct accel_hist read_age_us;          // age of the sample a one-shot read returns
+} stats;
+static atomic_t ring_lost = ATOMIC_INIT(0); // samples skipped by lapped read() callers
+
+// Orientation engine (orient.c) fed with every captured sample under accel_lock.
+// Its events go to a second, smaller ring that only the capture thread writes;
+// files switched over with ACCEL_IOC_EVENTS read it with their own cursor.
+static struct orient_state orient = { .tilt_step = 500 };  // TILT every 5 degrees
+static struct accel_event event_ring[ACCEL_EVENT_QUEUE];
+static uint32_t event_head;
+static atomic_t event_readers = ATOMIC_INIT(0);
+
+// Input device fed with the same samples as the ring: one ABS_X/ABS_Y/ABS_Z
+// frame in milli-g per sample, closed by input_sync() so evdev clients get
+// whole samples, and BTN_0/BTN_1 for single/double taps. While it is open it
+// counts as an event reader, and it starts capture if nobody else has.
+#define INPUT_MAX_MG 16000
+#define INPUT_RES 1000                  // units per g
+
+static struct input_dev *accel_input;
+static bool input_started;              // capture was started by accel_input_open()
+
+// "capture auto" is on, and the part is asleep after INACTIVITY (capture.h)
+static bool capture_auto;
+static bool capture_idle;
+#define EVENT_INTERRUPTS (XL345_SINGLETAP | XL345_DOUBLETAP | XL345_FREEFALL)
+#define ACT_MG_MIN 63                   // THRESH_ACT/THRESH_INACT: 1 to 255 LSB of 62.5 mg
+#define ACT_MG_MAX 15937
+#define FF_MS_MAX 1275                  // TIME_FF: 255 LSB of 5 ms
+
+
+//The functions for the character device driver
+static int device_open (struct inode *, struct file *);
+static int device_release (struct inode *, struct file *);
+static ssize_t device_read (struct file *, char *, size_t, loff_t *);
+static ssize_t device_write (struct file *, const char *, size_t, loff_t *);
+static unsigned int device_poll (struct file *, poll_table *);
+static int device_mmap (struct file *, struct vm_area_struct *);
+static long device_ioctl (struct file *, unsigned int, unsigned long);
+
+#define SUCCESS 0
+#define DEVICE_NAME "accel"
+#define MAX_SIZE 25
+
+static char accel_msg2[MAX_SIZE];
+
+//Pointers for character device driver
+static dev_t accel_no = 0;
+static struct cdev *accel_cdev = NULL;
+static struct class *accel_class = NULL;
+static struct device *accel_device = NULL;
+
+//File Operations structure to open, release, read and write device-driver
+static struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.read = device_read,
+	.write = device_write,
+	.open = device_open,
+	.release = device_release,
+	.poll = device_poll,
+	.mmap = device_mmap,
+	.unlocked_ioctl = device_ioctl
+};
+
+
+// Find the BW_RATE code for a rate given in hundredths of a Hz. A rate without
+// a fraction also matches by its whole part, so "12", "6", "3" and "1" still
+// select 12.5, 6.25, 3.13 and 1.56 Hz.
+static int ADXL345_Rate_Code(uint32_t centihz, bool has_fraction){
+    int i;
+
+    for (i = 0; i < (int) ARRAY_SIZE(rate_table); i++){
+        if (has_fraction && abs((int) rate_table[i].centihz - (int) centihz) <= 1)
+            return i;
+        if (!has_fraction && centihz > 0 && rate_table[i].centihz / 100 == centihz / 100)
+            return i;
+    }
+    return -EINVAL;
+}
+
+// Program the offset registers (LSB 15.6 mg) and remember them so they can be
+// read back from sysfs and handed to the next insmod through the offsets parameter
+int ADXL345_Set_Offsets(int8_t x, int8_t y, int8_t z){
+    uint8_t ofs[3] = { x, y, z };
+    int err;
+
+    if ((err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_OFSX, ofs, sizeof(ofs))) < 0)
+        return err;
+
+    offsets[0] = x;
+    offsets[1] = y;
+    offsets[2] = z;
+    num_offsets = 3;
+    return 0;
+}
+
+// Background job queued by the "calibrate" command. The offsets are remembered
+// so they can be read back from sysfs and handed to the next insmod through the
+// offsets parameter.
+static void calibrate_work_fn(struct work_struct *work){
+    int8_t ofs[3];
+    int err = ADXL345_Calibrate(&accel_lock, cal_total, &cal_done, ofs);
+
+    mutex_lock(&accel_lock);
+    if (err == 0){
+        offsets[0] = ofs[0];
+        offsets[1] = ofs[1];
+        offsets[2] = ofs[2];
+        num_offsets = 3;
+    }
+    cal_err = err;
+    cal_state = err < 0 ? CAL_FAILED : CAL_DONE;
+    mutex_unlock(&accel_lock);
+
+    if (err < 0)
+        printk(KERN_ERR "accel: calibration failed with return value %d\n", err);
+    else
+        printk("The device has been calibrated\n");
+
+    sysfs_notify(&accel_device->kobj, NULL, "calibration");
+}
+
+// Time back to back ADXL345_XYZ_Read() calls for BENCH_MS at 3200 Hz, where a
+// new sample is always ready. Called with accel_lock held; it is let go between
+// reads.
+static int bench_xyz_read(void){
+    int16_t xyz[3];
+    uint32_t us, min_us = UINT_MAX, max_us = 0, reads = 0;
+    uint64_t sum_us = 0;
+    ktime_t start, t;
+    s64 elapsed_us;
+    int err;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_3200)) < 0)
+        return err;
+
+    start = ktime_get();
+    do {
+        t = ktime_get();
+        if ((err = ADXL345_XYZ_Read(xyz)) < 0)
+            return err;
+        us = ktime_us_delta(ktime_get(), t);
+        min_us = min(min_us, us);
+        max_us = max(max_us, us);
+        sum_us += us;
+        reads++;
+
+        mutex_unlock(&accel_lock);
+        cond_resched();
+        mutex_lock(&accel_lock);
+    } while ((elapsed_us = ktime_us_delta(ktime_get(), start)) < BENCH_MS * USEC_PER_MSEC);
+
+    test.reads = div64_u64((u64) reads * USEC_PER_SEC, elapsed_us);
+    test.read_min_us = min_us;
+    test.read_avg_us = div_u64(sum_us, reads);
+    test.read_max_us = max_us;
+    return 0;
+}
+
+// Drain the FIFO in stream mode at one rate for BENCH_MS, sleeping between
+// batches like the capture thread, and count what arrives and what it cost on
+// the bus. Called with accel_lock held; it is dropped while sleeping.
+static int bench_rate(uint8_t code){
+    int16_t batch[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    unsigned int sleep_us = Capture_Sleep_us(code, false, ktime_get());
+    typeof(test.rate[0]) *result = &test.rate[code - XL345_RATE_12_5];
+    struct adxl345_clock clock;
+    struct i2c0_stats before, after;
+    uint64_t samples = 0;
+    uint8_t int_source;
+    ktime_t start;
+    s64 elapsed_us;
+    int n, err;
+
+    // Passing through bypass empties the FIFO
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, code)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK)) < 0)
+        return err;
+
+    ADXL345_Clock_Reset(&clock);
+    I2C0_Stats_Get(&before);
+    start = ktime_get();
+    do {
+        mutex_unlock(&accel_lock);
+        usleep_range(sleep_us, sleep_us + sleep_us / 4);
+        mutex_lock(&accel_lock);
+
+        if ((n = Capture_Drain(&clock, code, false, batch, time, &int_source, &sleep_us)) < 0)
+            return n;
+        samples += n;
+        if (int_source & XL345_OVERRUN)
+            result->overruns++;
+    } while ((elapsed_us = ktime_us_delta(ktime_get(), start)) < BENCH_MS * USEC_PER_MSEC);
+    I2C0_Stats_Get(&after);
+
+    result->centisps = div64_u64(samples * 100 * USEC_PER_SEC, elapsed_us);
+    result->transfers = div64_u64((u64) (after.transfers - before.transfers) * USEC_PER_SEC, elapsed_us);
+    if (after.time_us.count > before.time_us.count)
+        result->transfer_us = div_u64(after.time_us.sum_us - before.time_us.sum_us,
+                                      after.time_us.count - before.time_us.count);
+
+    return ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS);
+}
+
+// Self-test and benchmark, results in test. Runs from selftest_work with the
+// same locking as ADXL345_Calibrate(); test_step counts the finished steps.
+static int ADXL345_Self_Test(void){
+    uint8_t saved_bw;
+    uint8_t saved_dataformat;
+    int i, err;
+
+    mutex_lock(&accel_lock);
+    memset(&test, 0, sizeof(test));
+
+    if ((err = ADXL345_REG_READ(ADXL345_REG_BW_RATE, &saved_bw)) < 0 ||
+        (err = ADXL345_REG_READ(ADXL345_REG_DATA_FORMAT, &saved_dataformat)) < 0)
+        goto out_unlock;
+
+    if ((err = ADXL345_Self_Test_Delta(&accel_lock, test.delta)) < 0)
+        goto out_restore;
+    test.pass = ADXL345_Self_Test_Pass(test.delta);
+    WRITE_ONCE(test_step, 1);
+
+    if ((err = bench_xyz_read()) < 0)
+        goto out_restore;
+    WRITE_ONCE(test_step, 2);
+
+    for (i = 0; i < BENCH_RATES; i++){
+        if ((err = bench_rate(XL345_RATE_12_5 + i)) < 0)
+            goto out_restore;
+        WRITE_ONCE(test_step, 3 + i);
+    }
+
+out_restore:
+    // Back to the rate and format the user set, FIFO in bypass as without capture
+    if (ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS) < 0 ||
+        ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, saved_bw) < 0 ||
+        ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, saved_dataformat) < 0)
+        printk(KERN_ERR "accel: could not restore settings after the self-test\n");
+out_unlock:
+    mutex_unlock(&accel_lock);
+    return err;
+}
+
+// Background job queued by the "selftest" command
+static void selftest_work_fn(struct work_struct *work){
+    int err = ADXL345_Self_Test();
+
+    mutex_lock(&accel_lock);
+    test_err = err;
+    test_state = err < 0 ? CAL_FAILED : CAL_DONE;
+    mutex_unlock(&accel_lock);
+
+    if (err < 0)
+        printk(KERN_ERR "accel: self-test failed with return value %d\n", err);
+    else
+        printk("accel: self-test %s (%d %d %d), %u reads/s\n", test.pass ? "passed" : "FAILED",
+            test.delta[0], test.delta[1], test.delta[2], test.reads);
+
+    sysfs_notify(&accel_device->kobj, NULL, "selftest");
+}
+
+static void sample_fill(struct accel_sample *sample, const int16_t xyz[3], uint8_t int_source, int32_t scale_q8,
+                        int64_t time_ns, uint32_t period_ns){
+
+    sample->time_ns = time_ns;
+    sample->mg[0] = xyz[0] * scale_q8;
+    sample->mg[1] = xyz[1] * scale_q8;
+    sample->mg[2] = xyz[2] * scale_q8;
+    sample->xyz[0] = xyz[0];
+    sample->xyz[1] = xyz[1];
+    sample->xyz[2] = xyz[2];
+    sample->int_source = int_source;
+    sample->period_ns = period_ns;
+}
+
+// Append one sample to the raw ring (Capture_Ring_Push()) and publish the new
+// head in the mapped header too
+static void ring_push(const int16_t xyz[3], uint8_t int_source, int32_t scale_q8, int64_t time_ns, uint32_t period_ns){
+    struct accel_sample sample;
+
+    sample_fill(&sample, xyz, int_source, scale_q8, time_ns, period_ns);
+    Capture_Ring_Push(&raw_ring, &sample);
+    smp_store_release(&ring->head, raw_ring.head);
+}
+
+// The same for the filtered stream. mg carries the filtered value, xyz stays the
+// raw reading of the FIFO entry the sample was kept from.
+static void filtered_push(const int16_t out[3], const int16_t raw[3], uint8_t int_source, int32_t scale_q8,
+                          int64_t time_ns, uint32_t period_ns){
+    struct accel_sample sample;
+
+    sample_fill(&sample, out, int_source, scale_q8, time_ns, period_ns);
+    memcpy(sample.xyz, raw, sizeof(sample.xyz));
+    Capture_Ring_Push(&filtered_ring, &sample);
+}
+
+static void latest_publish(const int16_t xyz[3], uint8_t int_source, int32_t scale_q8, int64_t time_ns, uint32_t period_ns){
+
+    write_seqlock(&latest_lock);
+    sample_fill(&latest, xyz, int_source, scale_q8, time_ns, period_ns);
+    write_sequnlock(&latest_lock);
+}
+
+// Copy the latest sample and return when it was taken
+static ktime_t latest_get(struct accel_sample *sample){
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&latest_lock);
+        *sample = latest;
+    } while (read_seqretry(&latest_lock, seq));
+    return ns_to_ktime(sample->time_ns);
+}
+
+// The stream a reader follows, the raw ring or the filtered one
+static struct capture_ring *reader_ring(struct accel_reader *reader){
+
+    return reader->filtered ? &filtered_ring : &raw_ring;
+}
+
+// Producer index of that stream
+static uint32_t *reader_head(struct accel_reader *reader){
+
+    return &reader_ring(reader)->head;
+}
+
+// Capture_Ring_Fetch() at the reader's cursor, counting what a lapped reader lost
+static bool ring_fetch(struct accel_reader *reader, struct accel_sample *sample){
+    uint32_t lost;
+    bool fetched = Capture_Ring_Fetch(reader_ring(reader), &reader->cursor, &lost, sample);
+
+    if (lost){
+        reader->overruns += lost;
+        atomic_add(lost, &ring_lost);
+    }
+    return fetched;
+}
+
+// Queue one event, same publication rules as ring_push()
+static void event_push(struct accel_event *ev){
+    uint32_t head = event_head;
+
+    ev->seq = raw_ring.head;
+    event_ring[head & (ACCEL_EVENT_QUEUE - 1)] = *ev;
+    smp_store_release(&event_head, head + 1);
+}
+
+// ring_fetch() for the event ring. Events lost to lapping are not counted.
+static bool event_fetch(struct accel_reader *reader, struct accel_event *ev){
+    uint32_t head = smp_load_acquire(&event_head);
+
+    if (head - reader->event_cursor >= ACCEL_EVENT_QUEUE)
+        reader->event_cursor = head - ACCEL_EVENT_QUEUE + 1;
+
+    *ev = event_ring[reader->event_cursor & (ACCEL_EVENT_QUEUE - 1)];
+    smp_rmb();
+    if (READ_ONCE(event_head) - reader->event_cursor >= ACCEL_EVENT_QUEUE)
+        return false;
+
+    reader->event_cursor++;
+    return true;
+}
+
+// Queue the tap and FREEFALL events of INT_SOURCE bits read without a sample.
+// Called with accel_lock held.
+static int orient_interrupts(uint8_t int_source){
+    struct accel_event ev[ORIENT_MAX_EVENTS];
+    int j, count = Orient_Interrupts(&orient, int_source, ev);
+
+    for (j = 0; j < count; j++)
+        event_push(&ev[j]);
+    return count;
+}
+
+// Run a raw FIFO batch through the orientation engine and queue what changed.
+// The INT_SOURCE bits were read once for the whole batch, so they go with its
+// first sample. Returns the number of events queued, *turned is set when the
+// face up changed. Called with accel_lock held.
+static int orient_run(int16_t batch[][3], int n, uint8_t int_source, int32_t scale_q8, bool *turned){
+    struct accel_event ev[ORIENT_MAX_EVENTS];
+    int32_t mg[3];
+    int i, j, count, queued = 0;
+
+    for (i = 0; i < n; i++){
+        for (j = 0; j < 3; j++)
+            mg[j] = (batch[i][j] * scale_q8 + 128) >> 8;
+        count = Orient_Update(&orient, mg, i == 0 ? int_source : 0, ev);
+        for (j = 0; j < count; j++){
+            if (ev[j].type == ACCEL_EV_ORIENT)
+                *turned = true;
+            event_push(&ev[j]);
+        }
+        queued += count;
+    }
+    return queued;
+}
+
+// Report the samples that went to the ring as input frames. A tap is pressed
+// in the frame of the first sample of its batch and released in its own frame.
+// Where the input core takes a timestamp, frames carry the conversion time
+// instead of the time they were synced.
+static void input_report_batch(int16_t batch[][3], const int64_t time[], int n, uint8_t int_source, int32_t scale_q8){
+    unsigned int button = int_source & XL345_DOUBLETAP ? BTN_1 : BTN_0;
+    bool tap = int_source & (XL345_SINGLETAP | XL345_DOUBLETAP);
+    int i;
+
+    for (i = 0; i < n; i++){
+        input_report_abs(accel_input, ABS_X, (batch[i][0] * scale_q8 + 128) >> 8);
+        input_report_abs(accel_input, ABS_Y, (batch[i][1] * scale_q8 + 128) >> 8);
+        input_report_abs(accel_input, ABS_Z, (batch[i][2] * scale_q8 + 128) >> 8);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+        input_set_timestamp(accel_input, ns_to_ktime(time[i]));
+#endif
+        if (i == 0 && tap)
+            input_report_key(accel_input, button, 1);
+        input_sync(accel_input);
+        if (i == 0 && tap){
+            input_report_key(accel_input, button, 0);
+            input_sync(accel_input);
+        }
+    }
+}
+
+// A tap read while "capture auto" is idle has no frame to go with: press and
+// release the button on their own
+static void input_report_tap(uint8_t int_source){
+    unsigned int button = int_source & XL345_DOUBLETAP ? BTN_1 : BTN_0;
+
+    if (!(int_source & (XL345_SINGLETAP | XL345_DOUBLETAP)))
+        return;
+    input_report_key(accel_input, button, 1);
+    input_sync(accel_input);
+    input_report_key(accel_input, button, 0);
+    input_sync(accel_input);
+}
+
+// Account for one drained FIFO batch, latency from each sample's conversion time
+static void capture_stats(int raw, uint8_t int_source, int err, const int64_t time[]){
+    int64_t publish_ns = ktime_to_ns(ktime_get());
+    int i;
+
+    spin_lock(&stats_lock);
+    stats.samples += raw;
+    if (int_source & XL345_OVERRUN)
+        stats.fifo_overruns++;
+    if (err < 0)
+        stats.read_errors++;
+    if (capture_auto && (int_source & XL345_INACTIVITY))
+        stats.sleeps++;
+    for (i = 0; i < raw; i++)
+        Accel_Hist_Add(&stats.latency_us, div_u64(max_t(int64_t, publish_ns - time[i], 0), NSEC_PER_USEC));
+    spin_unlock(&stats_lock);
+}
+
+// While "capture auto" is idle: check for ACTIVITY (Capture_Check_Wake()) and
+// return how long to sleep. Called with accel_lock held.
+static unsigned int capture_check_wake(uint8_t *int_source){
+    int err;
+
+    *int_source = 0;
+    err = Capture_Check_Wake(&sample_clock, int_source);
+
+    if (err > 0)
+        capture_idle = false;
+
+    spin_lock(&stats_lock);
+    if (err < 0)
+        stats.read_errors++;
+    else if (!capture_idle)
+        stats.wakeups++;
+    spin_unlock(&stats_lock);
+    if (err < 0)
+        printk_ratelimited(KERN_ERR "accel: capture read failed with return value %d\n", err);
+
+    return capture_idle ? AUTO_IDLE_POLL_US : ADXL345_Period_us(bw_rate) * CAPTURE_WATERMARK;
+}
+
+// Drain the FIFO (stream mode) into the raw ring and, through the filter
+// pipeline, the filtered stream, then sleep until about
+// CAPTURE_WATERMARK new samples are due, or only one while a file waits for
+// events so that they follow the motion within a sample period. The bus is
+// only taken with trylock so that capture_stop() can wait for this thread while
+// holding accel_lock.
+// The ACTIVITY and INACTIVITY bits of "capture auto" end up in the int_source
+// of the first and last sample of each segment. Taps and FREEFALL while idle
+// are queued as events when they are read.
+// Each FIFO entry gets its conversion time from sample_clock, see
+// ADXL345_Clock_Batch().
+static int capture_thread(void *data){
+    int16_t batch[XL345_FIFO_DEPTH][3], filtered[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    int keep[XL345_FIFO_DEPTH];
+    uint8_t int_source = 0, wake_source = 0, idle_source;
+    unsigned int sleep_us;
+    uint32_t period_ns = 0;
+    int32_t scale_q8 = 0;
+    ktime_t timeout;
+    bool turned;
+    int n, raw, i, events;
+    int err;
+
+    while (!kthread_should_stop()){
+        sleep_us = CAPTURE_MIN_SLEEP_US;
+
+        if (mutex_trylock(&accel_lock)){
+            if (capture_idle){
+                sleep_us = capture_check_wake(&wake_source);
+                // Reading INT_SOURCE cleared the taps and FREEFALL that came
+                // in meanwhile. They go out now rather than with the next
+                // batch, which may be seconds away; only ACTIVITY is kept for it.
+                idle_source = wake_source & EVENT_INTERRUPTS;
+                events = orient_interrupts(idle_source);
+                wake_source &= XL345_ACTIVITY;
+                mutex_unlock(&accel_lock);
+
+                input_report_tap(idle_source);
+                if (events > 0)
+                    wake_up_interruptible(&ring_wait);
+                goto sleep;
+            }
+
+            err = raw = Capture_Drain(&sample_clock, bw_rate, atomic_read(&event_readers) != 0,
+                                      batch, time, &int_source, &sleep_us);
+            if (raw < 0)
+                raw = 0;
+            int_source |= wake_source;
+            wake_source = 0;
+            scale_q8 = mg_per_lsb_q8;
+            period_ns = sample_clock.period_ns;
+            turned = false;
+            events = orient_run(batch, raw, int_source, scale_q8, &turned);
+            n = Filter_Run(&filter, batch, filtered, keep, raw);
+            if (capture_auto && (int_source & XL345_INACTIVITY)){
+                // The part is going to sleep: this batch ends the segment
+                capture_idle = true;
+                sleep_us = AUTO_IDLE_POLL_US;
+            }
+            mutex_unlock(&accel_lock);
+
+            for (i = 0; i < raw; i++)
+                ring_push(batch[i], int_source, scale_q8, time[i], period_ns);
+            for (i = 0; i < n; i++)
+                filtered_push(filtered[i], batch[keep[i]], int_source, scale_q8, time[keep[i]], period_ns);
+            if (raw > 0)
+                latest_publish(batch[raw - 1], int_source, scale_q8, time[raw - 1], period_ns);
+            input_report_batch(batch, time, raw, int_source, scale_q8);
+            if (raw > 0 || events > 0)
+                wake_up_interruptible(&ring_wait);
+            if (turned)
+                sysfs_notify(&accel_device->kobj, NULL, "orientation");
+            capture_stats(raw, int_source, err, time);
+            if (err < 0)
+                printk_ratelimited(KERN_ERR "accel: capture read failed with return value %d\n", err);
+        }
+
+sleep:
+        sleep_us = clamp(sleep_us, (unsigned int) CAPTURE_MIN_SLEEP_US, (unsigned int) CAPTURE_MAX_SLEEP_US);
+        timeout = ns_to_ktime((u64) sleep_us * NSEC_PER_USEC);
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (!kthread_should_stop())
+            schedule_hrtimeout_range(&timeout, (u64) sleep_us * NSEC_PER_USEC / 4, HRTIMER_MODE_REL);
+        __set_current_state(TASK_RUNNING);
+    }
+    return 0;
+}
+
+// Undo capture_start(): FIFO back to bypass and, after "capture auto", keep
+// measuring without link mode or AUTO_SLEEP. AUTO_SLEEP is cleared through
+// standby as the datasheet asks. Called with accel_lock held.
+static int capture_restore(bool auto_sleep){
+    int err;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS)) < 0 || !auto_sleep)
+        return err;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_MEASURE)) < 0)
+        return err;
+    return ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE, EVENT_INTERRUPTS);
+}
+
+// Put the FIFO in stream mode and start the capture thread. Called with accel_lock held.
+// With auto_sleep the activity and inactivity interrupts are enabled and the
+// part is put in link mode with AUTO_SLEEP ("capture auto").
+static int capture_start(bool auto_sleep){
+    int err;
+
+    if (capture_task)
+        return capture_auto == auto_sleep ? 0 : -EBUSY;
+
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK)) < 0)
+        return err;
+    if (auto_sleep &&
+        ((err = ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE, EVENT_INTERRUPTS | XL345_ACTIVITY | XL345_INACTIVITY)) < 0 ||
+         (err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY)) < 0 ||
+         (err = ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, AUTO_POWER_CTL)) < 0))
+        goto err_restore;
+
+    capture_auto = auto_sleep;
+    capture_idle = false;
+    Orient_Reset(&orient);
+    ADXL345_Clock_Reset(&sample_clock);
+    capture_task = kthread_run(capture_thread, NULL, "accel_capture");
+    if (IS_ERR(capture_task)){
+        err = PTR_ERR(capture_task);
+        capture_task = NULL;
+        goto err_restore;
+    }
+    return 0;
+
+err_restore:
+    capture_restore(auto_sleep);
+    return err;
+}
+
+// Stop the capture thread and return the FIFO to bypass mode. Called with accel_lock held.
+static int capture_stop(void){
+
+    if (!capture_task)
+        return 0;
+
+    kthread_stop(capture_task);
+    capture_task = NULL;
+    wake_up_interruptible(&ring_wait);
+
+    return capture_restore(capture_auto);
+}
+
+// First evdev client: make sure samples flow, and at one frame per sample period
+static int accel_input_open(struct input_dev *dev){
+    int err = 0;
+
+    mutex_lock(&accel_lock);
+    if (sensor_busy())
+        err = -EBUSY;
+    else if (!capture_task && (err = capture_start(false)) == 0)
+        input_started = true;
+    if (err == 0)
+        atomic_inc(&event_readers);
+    mutex_unlock(&accel_lock);
+    return err;
+}
+
+// Last evdev client gone: stop capture again unless a "capture" command took it over
+static void accel_input_close(struct input_dev *dev){
+
+    mutex_lock(&accel_lock);
+    atomic_dec(&event_readers);
+    if (input_started)
+        capture_stop();
+    input_started = false;
+    mutex_unlock(&accel_lock);
+}
+
+// /sys/class/accel/accel/calibration: "idle", "running <done>/<total>", "done" or
+// "failed <err>". sysfs_notify() is raised when a calibration finishes, so
+// userspace can poll() this file for completion.
+static ssize_t calibration_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    switch (READ_ONCE(cal_state)){
+        case CAL_RUNNING:
+            return sprintf(buf, "running %d/%d\n", READ_ONCE(cal_done), cal_total);
+        case CAL_DONE:
+            return sprintf(buf, "done\n");
+        case CAL_FAILED:
+            return sprintf(buf, "failed %d\n", cal_err);
+        default:
+            return sprintf(buf, "idle\n");
+    }
+}
+static DEVICE_ATTR(calibration, S_IRUGO, calibration_show, NULL);
+
+// /sys/class/accel/accel/selftest: "idle", "running <step>/<steps>" or "failed
+// <err>", and after a "selftest" has finished its results:
+//   selftest pass|fail <x> <y> <z>        SELF_TEST deflection in LSB of 3.9 mg
+//   xyz_read <per s> <min> <avg> <max>    back to back ADXL345_XYZ_Read(), us
+//   rate <Hz> <samples/s> <overruns> <transfers/s> <transfer us>
+// with one rate line per FIFO rate. Raises sysfs_notify() when a run finishes.
+static ssize_t selftest_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    uint32_t centihz;
+    int len, i;
+
+    switch (READ_ONCE(test_state)){
+        case CAL_RUNNING:
+            return sprintf(buf, "running %d/%d\n", READ_ONCE(test_step), TEST_STEPS);
+        case CAL_FAILED:
+            return sprintf(buf, "failed %d\n", test_err);
+        case CAL_IDLE:
+            return sprintf(buf, "idle\n");
+        default:
+            break;
+    }
+
+    len = sprintf(buf, "selftest %s %d %d %d\n", test.pass ? "pass" : "fail",
+        test.delta[0], test.delta[1], test.delta[2]);
+    len += sprintf(buf + len, "xyz_read %u %u %u %u\n", test.reads,
+        test.read_min_us, test.read_avg_us, test.read_max_us);
+    for (i = 0; i < BENCH_RATES; i++){
+        // rate_table runs from 3200 Hz down one BW_RATE code per entry
+        centihz = rate_table[XL345_RATE_3200 - (XL345_RATE_12_5 + i)].centihz;
+        len += sprintf(buf + len, "rate %u.%02u %u.%02u %u %u %u\n", centihz / 100, centihz % 100,
+            test.rate[i].centisps / 100, test.rate[i].centisps % 100, test.rate[i].overruns,
+            test.rate[i].transfers, test.rate[i].transfer_us);
+    }
+    return len;
+}
+static DEVICE_ATTR(selftest, S_IRUGO, selftest_show, NULL);
+
+// /sys/class/accel/accel/filter: the current pipeline configuration
+static ssize_t filter_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "hp %d lp %d avg %d decimate %d\n",
+        filter.hp_shift, filter.lp_shift, filter.avg_len, filter.decimate);
+}
+static DEVICE_ATTR(filter, S_IRUGO, filter_show, NULL);
+
+// /sys/class/accel/accel/scale: exact milli-g per LSB of the raw values
+static ssize_t scale_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    int32_t scale_q8 = READ_ONCE(mg_per_lsb_q8);
+
+    return sprintf(buf, "%d.%05d\n", scale_q8 >> 8, ((scale_q8 & 0xFF) * 100000) >> 8);
+}
+static DEVICE_ATTR(scale, S_IRUGO, scale_show, NULL);
+
+// /sys/class/accel/accel/offsets: "OFSX OFSY OFSZ" currently programmed. Writing
+// the same format restores a saved calibration without measuring.
+static ssize_t offsets_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    return sprintf(buf, "%d %d %d\n", offsets[0], offsets[1], offsets[2]);
+}
+
+static ssize_t offsets_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int x, y, z;
+    int err;
+
+    if (sscanf(buf, "%d %d %d", &x, &y, &z) != 3)
+        return -EINVAL;
+    if (x < -128 || x > 127 || y < -128 || y > 127 || z < -128 || z > 127)
+        return -ERANGE;
+
+    mutex_lock(&accel_lock);
+    if (sensor_busy())
+        err = -EBUSY;
+    else
+        err = ADXL345_Set_Offsets(x, y, z);
+    mutex_unlock(&accel_lock);
+
+    return err < 0 ? err : (ssize_t) count;
+}
+static DEVICE_ATTR(offsets, S_IRUGO | S_IWUSR, offsets_show, offsets_store);
+
+// /sys/class/accel/accel/stats: counters as "name value" lines. Writing "reset"
+// clears them together with the latency histograms. ring_lost only counts
+// samples skipped by read(); mmap readers keep track of their own cursors.
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct i2c0_stats i2c;
+    typeof(stats) s;
+
+    I2C0_Stats_Get(&i2c);
+    spin_lock(&stats_lock);
+    s = stats;
+    spin_unlock(&stats_lock);
+
+    return sprintf(buf,
+        "samples %u\nfifo_overruns %u\nring_lost %u\nread_errors %u\nreads %u\ncached_reads %u\n"
+        "sleeps %u\nwakeups %u\n"
+        "i2c_transfers %u\ni2c_bytes %llu\ni2c_aborts %u\ni2c_timeouts %u\ni2c_shadow_hits %u\n",
+        s.samples, s.fifo_overruns, atomic_read(&ring_lost), s.read_errors, s.reads, s.cached_reads,
+        s.sleeps, s.wakeups,
+        i2c.transfers, (unsigned long long) i2c.bytes, i2c.aborts, i2c.timeouts, i2c.shadow_hits);
+}
+
+static ssize_t stats_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    if (!sysfs_streq(buf, "reset"))
+        return -EINVAL;
+
+    I2C0_Stats_Reset();
+    spin_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    spin_unlock(&stats_lock);
+    atomic_set(&ring_lost, 0);
+    return count;
+}
+static DEVICE_ATTR(stats, S_IRUGO | S_IWUSR, stats_show, stats_store);
+
+// One histogram line: name, count, average and maximum in us, then the buckets
+// (< 1 us, < 2 us, < 4 us, ... and the rest)
+static int hist_show(char *buf, const char *name, const struct accel_hist *hist)
+{
+    int len, i;
+
+    len = sprintf(buf, "%s %u %llu %u", name, hist->count,
+        hist->count ? (unsigned long long) div_u64(hist->sum_us, hist->count) : 0ULL, hist->max_us);
+    for (i = 0; i < ACCEL_HIST_BUCKETS; i++)
+        len += sprintf(buf + len, " %u", hist->bucket[i]);
+    return len + sprintf(buf + len, "\n");
+}
+
+// /sys/class/accel/accel/latency: "i2c" is the duration of each bus transfer,
+// "fifo" the time from conversion to the sample being in the ring while
+// capturing, "read_age" how old the sample returned by a one-shot read() was
+static ssize_t latency_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct i2c0_stats i2c;
+    typeof(stats) s;
+    int len;
+
+    I2C0_Stats_Get(&i2c);
+    spin_lock(&stats_lock);
+    s = stats;
+    spin_unlock(&stats_lock);
+
+    len = hist_show(buf, "i2c", &i2c.time_us);
+    len += hist_show(buf + len, "fifo", &s.latency_us);
+    len += hist_show(buf + len, "read_age", &s.read_age_us);
+    return len;
+}
+static DEVICE_ATTR(latency, S_IRUGO, latency_show, NULL);
+
+// Hundredths of a degree as "[-]d.dd"
+static int centideg_show(char *buf, int centideg)
+{
+    return sprintf(buf, " %s%d.%02d", centideg < 0 ? "-" : "", abs(centideg) / 100, abs(centideg) % 100);
+}
+
+// /sys/class/accel/accel/orientation: "<face up> <pitch> <roll>", the angles in
+// degrees, as of the last captured sample. sysfs_notify() is raised when the
+// face up changes, so userspace can poll() this file instead of reading events.
+static ssize_t orientation_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    static const char * const names[] = { "unknown", "x_up", "x_down", "y_up", "y_down", "z_up", "z_down" };
+    struct orient_state st;
+    int len;
+
+    mutex_lock(&accel_lock);
+    st = orient;
+    mutex_unlock(&accel_lock);
+
+    len = sprintf(buf, "%s", names[st.orientation]);
+    len += centideg_show(buf + len, st.pitch);
+    len += centideg_show(buf + len, st.roll);
+    return len + sprintf(buf + len, "\n");
+}
+static DEVICE_ATTR(orientation, S_IRUGO, orientation_show, NULL);
+
+ /* Code to initialize the accel driver */
+static int __init start_accel(void)
+{
+
+    int err = 0;
+    uint8_t ofs[3];
+    // generate a virtual addresses
+    I2C0_ptr = ioremap_nocache (0xFFC04000, 0x00000100);
+    SYSMGR_ptr = ioremap_nocache (0xFFD08000, 0x00000800);
+    if ((I2C0_ptr == NULL) || (SYSMGR_ptr == NULL)){
+
+        printk(KERN_ERR "Error: ioremap_nocache returned NULL\n");
+        err = -ENOMEM;
+        goto err_unmap;
+
+    }
+
+    // Allocate the sample ring: a header page followed by the slots
+    if (ring_samples < 2)
+        ring_samples = 2;
+    ring_samples = roundup_pow_of_two(ring_samples);
+    ring_bytes = PAGE_ALIGN(sizeof(struct accel_ring)) + ring_samples * sizeof(struct accel_sample);
+    ring = vmalloc_user(ring_bytes);
+    filtered_ring.data = vmalloc(ring_samples * sizeof(struct accel_sample));
+    if (ring == NULL || filtered_ring.data == NULL){
+        err = -ENOMEM;
+        goto err_unmap;
+    }
+    raw_ring.data = (void *) ring + PAGE_ALIGN(sizeof(struct accel_ring));
+    raw_ring.size = ring_samples;
+    raw_ring.head = 0;
+    filtered_ring.size = ring_samples;
+    filtered_ring.head = 0;
+    ring->version = ACCEL_RING_VERSION;
+    ring->size = raw_ring.size;
+    ring->sample_size = sizeof(struct accel_sample);
+    ring->data_offset = PAGE_ALIGN(sizeof(struct accel_ring));
+
+    Pinmux_Config();
+    if ((err = I2C0_Init()) < 0 || (err = ADXL345_Init()) < 0 || (err = ADXL345_TAP()) < 0 ||
+        (err = ADXL345_FreeFall()) < 0){
+        printk(KERN_ERR "accel: ADXL345 setup failed with return value %d\n", err);
+        goto err_unmap;
+    }
+    bw_rate = ADXL345_INIT_RATE;
+    mg_per_lsb_q8 = ADXL345_Scale_q8(ADXL345_INIT_FORMAT);
+
+    // Restore a saved calibration instead of measuring again
+    if (num_offsets == 3 && (err = ADXL345_Set_Offsets(offsets[0], offsets[1], offsets[2])) < 0){
+        printk(KERN_ERR "accel: restoring offsets failed with return value %d\n", err);
+        goto err_unmap;
+    }
+    else if (num_offsets != 3){
+        num_offsets = 0;
+        if ((err = ADXL345_REG_READ(ADXL345_REG_OFSX, &ofs[0])) < 0 ||
+            (err = ADXL345_REG_READ(ADXL345_REG_OFSY, &ofs[1])) < 0 ||
+            (err = ADXL345_REG_READ(ADXL345_REG_OFSZ, &ofs[2])) < 0)
+            goto err_unmap;
+        offsets[0] = (int8_t) ofs[0];
+        offsets[1] = (int8_t) ofs[1];
+        offsets[2] = (int8_t) ofs[2];
+    }
+
+    // initialize the dev_t, cdev, and class data structures. /dev/accel only
+    // appears now that the registers and the ring it reaches are set up, the
+    // input device after it as capture notifies through accel_device
+
+	if ((err = alloc_chrdev_region (&accel_no, 0, 1, DEVICE_NAME)) < 0) {
+		printk (KERN_ERR "accel: alloc_chrdev_region() failed with return value %d\n", err);
+		goto err_unmap;
+	}
+
+	// Allocate and initialize the character device
+	accel_cdev = cdev_alloc ();
+	accel_cdev->ops = &fops;
+	accel_cdev->owner = THIS_MODULE;
+
+	// Add the character device to the kernel
+	if ((err = cdev_add (accel_cdev, accel_no, 1)) < 0) {
+		printk (KERN_ERR "accel: cdev_add() failed with return value %d\n", err);
+		goto err_cdev;
+	}
+
+	accel_class = class_create (THIS_MODULE, DEVICE_NAME);
+	accel_device = device_create (accel_class, NULL, accel_no, NULL, DEVICE_NAME );
+
+    accel_input = input_allocate_device();
+    if (accel_input == NULL){
+        err = -ENOMEM;
+        goto err_device;
+    }
+    accel_input->name = "ADXL345 accelerometer";
+    accel_input->phys = "accel/input0";
+    accel_input->id.bustype = BUS_I2C;
+    accel_input->open = accel_input_open;
+    accel_input->close = accel_input_close;
+#ifdef INPUT_PROP_ACCELEROMETER
+    __set_bit(INPUT_PROP_ACCELEROMETER, accel_input->propbit);
+#endif
+    input_set_abs_params(accel_input, ABS_X, -INPUT_MAX_MG, INPUT_MAX_MG, 0, 0);
+    input_set_abs_params(accel_input, ABS_Y, -INPUT_MAX_MG, INPUT_MAX_MG, 0, 0);
+    input_set_abs_params(accel_input, ABS_Z, -INPUT_MAX_MG, INPUT_MAX_MG, 0, 0);
+    input_abs_set_res(accel_input, ABS_X, INPUT_RES);
+    input_abs_set_res(accel_input, ABS_Y, INPUT_RES);
+    input_abs_set_res(accel_input, ABS_Z, INPUT_RES);
+    input_set_capability(accel_input, EV_KEY, BTN_0);
+    input_set_capability(accel_input, EV_KEY, BTN_1);
+    if ((err = input_register_device(accel_input)) < 0){
+        printk(KERN_ERR "accel: input_register_device() failed with return value %d\n", err);
+        input_free_device(accel_input);
+        goto err_device;
+    }
+
+    device_create_file(accel_device, &dev_attr_calibration);
+    device_create_file(accel_device, &dev_attr_selftest);
+    device_create_file(accel_device, &dev_attr_offsets);
+    device_create_file(accel_device, &dev_attr_filter);
+    device_create_file(accel_device, &dev_attr_scale);
+    device_create_file(accel_device, &dev_attr_stats);
+    device_create_file(accel_device, &dev_attr_latency);
+    device_create_file(accel_device, &dev_attr_orientation);
+
+    return 0;
+
+err_device:
+    device_destroy (accel_class, accel_no);
+	class_destroy (accel_class);
+err_cdev:
+	cdev_del (accel_cdev);
+	unregister_chrdev_region (accel_no, 1);
+err_unmap:
+    vfree(filtered_ring.data);
+    vfree(ring);
+    if (I2C0_ptr) iounmap ((void *) I2C0_ptr);
+    if (SYSMGR_ptr) iounmap ((void *) SYSMGR_ptr);
+    return err;
+ }
+
+
+
+static void __exit stop_accel(void)
+{
+    cancel_work_sync(&calibrate_work);
+    cancel_work_sync(&selftest_work);
+    // The capture thread reports to accel_input, stop it before that goes.
+    // An evdev open that restarts it meanwhile is closed by the unregister.
+    mutex_lock(&accel_lock);
+    capture_stop();
+    mutex_unlock(&accel_lock);
+    input_unregister_device(accel_input);
+    device_remove_file(accel_device, &dev_attr_orientation);
+    device_remove_file(accel_device, &dev_attr_latency);
+    device_remove_file(accel_device, &dev_attr_stats);
+    device_remove_file(accel_device, &dev_attr_scale);
+    device_remove_file(accel_device, &dev_attr_filter);
+    device_remove_file(accel_device, &dev_attr_offsets);
+    device_remove_file(accel_device, &dev_attr_selftest);
+    device_remove_file(accel_device, &dev_attr_calibration);
+
+    /* unmap the physical-to-virtual mappings */
+    iounmap ((void *) I2C0_ptr);
+    iounmap ((void *) SYSMGR_ptr);
+    vfree(filtered_ring.data);
+    vfree(ring);
+
+    /* Remove the device from the kernel */
+    device_destroy (accel_class, accel_no);
+	cdev_del (accel_cdev);
+	class_destroy (accel_class);
+	unregister_chrdev_region (accel_no, 1);
+}
+
+ static int device_open(struct inode *inode, struct file *file)
+ {
+    struct accel_reader *reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+
+    if (reader == NULL)
+        return -ENOMEM;
+
+    // Start with the next captured sample
+    reader->cursor = smp_load_acquire(&raw_ring.head);
+    file->private_data = reader;
+    return SUCCESS;
+ }
+ static int device_release(struct inode *inode, struct file *file)
+ {
+    struct accel_reader *reader = file->private_data;
+
+    if (reader->events)
+        atomic_dec(&event_readers);
+    kfree(reader);
+    return SUCCESS;
+ }
+
+ // One text line per sample: INT_SOURCE, raw X Y Z, X Y Z in milli-g (rounded),
+ // then the conversion time in seconds on CLOCK_MONOTONIC
+ static int format_sample(char *msg, const struct accel_sample *sample)
+ {
+    const int32_t *mg_q8 = sample->mg;
+    u32 rem;
+    u64 sec = div_u64_rem(sample->time_ns, NSEC_PER_SEC, &rem);
+
+    return sprintf(msg, "%2X %4d %4d %4d %6d %6d %6d %llu.%06u\n", sample->int_source,
+        sample->xyz[0], sample->xyz[1], sample->xyz[2],
+        (mg_q8[0] + 128) >> 8, (mg_q8[1] + 128) >> 8, (mg_q8[2] + 128) >> 8,
+        (unsigned long long) sec, rem / 1000);
+ }
+
+ // While capturing, return as many lines from the shared ring as fit, starting at
+ // this reader's cursor. Blocks until a sample arrives unless O_NONBLOCK, and
+ // returns end of file once capture is turned off.
+ static ssize_t stream_read(struct accel_reader *reader, struct file *filp, char *buffer, size_t length)
+ {
+    struct accel_sample sample;
+    size_t done = 0, bytes;
+    int err;
+
+    while (done < length){
+        if (reader->msg_pos == reader->msg_len){
+            if (smp_load_acquire(reader_head(reader)) == reader->cursor){
+                if (done > 0 || !READ_ONCE(capture_task))
+                    break;
+                if (filp->f_flags & O_NONBLOCK)
+                    return -EAGAIN;
+                err = wait_event_interruptible(ring_wait,
+                    smp_load_acquire(reader_head(reader)) != reader->cursor || !READ_ONCE(capture_task));
+                if (err < 0)
+                    return err;
+                continue;
+            }
+            if (!ring_fetch(reader, &sample))
+                continue;
+            reader->msg_len = format_sample(reader->msg, &sample);
+            reader->msg_pos = 0;
+        }
+
+        bytes = min_t(size_t, length - done, reader->msg_len - reader->msg_pos);
+        if (copy_to_user(buffer + done, &reader->msg[reader->msg_pos], bytes) != 0)
+            return done ? (ssize_t) done : -EFAULT;
+        reader->msg_pos += bytes;
+        done += bytes;
+    }
+    return done;
+ }
+
+ // ACCEL_IOC_EVENTS files: as many whole events as fit in the buffer. Blocks for
+ // the first one unless O_NONBLOCK, end of file once capture is off and this
+ // reader has seen every queued event.
+ static ssize_t event_read(struct accel_reader *reader, struct file *filp, char *buffer, size_t length)
+ {
+    struct accel_event ev;
+    size_t done = 0;
+    int err;
+
+    if (length < sizeof(ev))
+        return -EINVAL;
+
+    while (done + sizeof(ev) <= length){
+        if (smp_load_acquire(&event_head) == reader->event_cursor){
+            if (done > 0 || !READ_ONCE(capture_task))
+                break;
+            if (filp->f_flags & O_NONBLOCK)
+                return -EAGAIN;
+            err = wait_event_interruptible(ring_wait,
+                smp_load_acquire(&event_head) != reader->event_cursor || !READ_ONCE(capture_task));
+            if (err < 0)
+                return err;
+            continue;
+        }
+        if (!event_fetch(reader, &ev))
+            continue;
+        if (copy_to_user(buffer + done, &ev, sizeof(ev)) != 0)
+            return done ? (ssize_t) done : -EFAULT;
+        done += sizeof(ev);
+    }
+    return done;
+ }
+
+ static ssize_t device_read(struct file *filp, char *buffer, size_t length, loff_t *offset)
+ {
+    struct accel_reader *reader = filp->private_data;
+	size_t bytes;
+    struct accel_sample sample;
+    ktime_t time;
+    int16_t xyz[3];
+    uint8_t int_source;
+    bool cached = true;
+    int err = 0;
+
+    if (reader->events)
+        return event_read(reader, filp, buffer, length);
+    if (READ_ONCE(capture_task))
+        return stream_read(reader, filp, buffer, length);
+
+    // One line per open/read cycle: sample on the first read, then report EOF
+    if (*offset == 0){
+        // While calibrating or self-testing, the sensor runs at another format: hand out
+        // the last sample instead of touching the bus. The same is done if the
+        // sample is younger than one output data period, without any lock.
+        time = latest_get(&sample);
+        if (!sensor_busy() &&
+            ktime_us_delta(ktime_get(), time) >= ADXL345_Period_us(READ_ONCE(bw_rate))){
+            mutex_lock(&accel_lock);
+            // Another reader may have fetched one while we waited for the lock
+            time = latest_get(&sample);
+            if (!sensor_busy() &&
+                ktime_us_delta(ktime_get(), time) >= ADXL345_Period_us(bw_rate)){
+                cached = false;
+                if ((err = ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &int_source)) == 0 &&
+                    (int_source & XL345_DATAREADY) &&
+                    (err = ADXL345_XYZ_Read(xyz)) == 0){
+                    // DATA_READY: converted at some point in the last period
+                    latest_publish(xyz, int_source, mg_per_lsb_q8,
+                                   ktime_to_ns(ktime_get()) - ADXL345_Period_ns(bw_rate) / 2,
+                                   ADXL345_Period_ns(bw_rate));
+                    time = latest_get(&sample);
+                }
+            }
+            mutex_unlock(&accel_lock);
+        }
+        reader->msg_len = format_sample(reader->msg, &sample);
+        reader->msg_pos = reader->msg_len;
+
+        spin_lock(&stats_lock);
+        stats.reads++;
+        if (cached)
+            stats.cached_reads++;
+        if (err < 0)
+            stats.read_errors++;
+        else
+            Accel_Hist_Add(&stats.read_age_us, ktime_us_delta(ktime_get(), time));
+        spin_unlock(&stats_lock);
+        if (err < 0)
+            return err;
+    }
+
+    if (*offset >= reader->msg_len)
+        return 0;
+    bytes = reader->msg_len - (*offset);	// how many bytes not yet sent?
+    bytes = bytes > length ? length : bytes;	// too much to send all at once?
+
+    if (copy_to_user (buffer, &reader->msg[*offset], bytes) != 0)
+        return -EFAULT;
+    *offset += bytes;	// keep track of number of bytes sent to the user
+    return bytes;
+}
+
+ // ACCEL_IOC_READER_STATS: this file's cursor and overrun count.
+ // ACCEL_IOC_EVENTS: switch this file to events, starting with the next one.
+ // ACCEL_IOC_FILTERED: switch this file to the filtered stream, the same way.
+ // ACCEL_IOC_CURSOR: move this file's cursor to where an mmap reader got to, so
+ // poll() waits for samples after it. It may not be ahead of head.
+ static long device_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+ {
+    struct accel_reader *reader = filp->private_data;
+    struct accel_reader_stats stats;
+    uint32_t cursor;
+
+    if (cmd == ACCEL_IOC_EVENTS){
+        reader->event_cursor = smp_load_acquire(&event_head);
+        if (!reader->events)
+            atomic_inc(&event_readers);
+        reader->events = true;
+        return 0;
+    }
+    if (cmd == ACCEL_IOC_FILTERED){
+        reader->cursor = smp_load_acquire(&filtered_ring.head);
+        reader->filtered = true;
+        return 0;
+    }
+    if (cmd == ACCEL_IOC_CURSOR){
+        if (copy_from_user(&cursor, (void __user *) arg, sizeof(cursor)) != 0)
+            return -EFAULT;
+        if (smp_load_acquire(reader_head(reader)) - cursor > raw_ring.size)
+            return -EINVAL;
+        reader->cursor = cursor;
+        reader->msg_pos = reader->msg_len = 0;
+        return 0;
+    }
+    if (cmd != ACCEL_IOC_READER_STATS)
+        return -ENOTTY;
+
+    stats.cursor = reader->cursor;
+    stats.head = smp_load_acquire(reader_head(reader));
+    stats.overruns = reader->overruns;
+    if (copy_to_user((void __user *) arg, &stats, sizeof(stats)) != 0)
+        return -EFAULT;
+    return 0;
+ }
+
+
+ // Parse "<whole>[.<fraction>]" into hundredths
+ static int parse_centi(const char *str, uint32_t *centi, bool *has_fraction)
+ {
+    unsigned int whole = 0, frac = 0, scale = 10;
+
+    if (*str < '0' || *str > '9')
+        return -EINVAL;
+    while (*str >= '0' && *str <= '9')
+        whole = whole * 10 + (*str++ - '0');
+
+    *has_fraction = (*str == '.');
+    if (*str == '.')
+        for (str++; *str >= '0' && *str <= '9'; str++, scale /= 10)
+            frac += (*str - '0') * scale;   // digits past the hundredths add 0
+    if (*str != '\0' || whole > 3200)
+        return -EINVAL;
+
+    *centi = whole * 100 + frac;
+    return 0;
+ }
+
+ // Readable while this reader has samples (or events) it has not seen or part of
+ // a line left, or always when not capturing since device_read() then does not wait
+ static unsigned int device_poll(struct file *filp, poll_table *wait)
+ {
+    struct accel_reader *reader = filp->private_data;
+
+    poll_wait(filp, &ring_wait, wait);
+
+    if (reader->events)
+        return !READ_ONCE(capture_task) || smp_load_acquire(&event_head) != reader->event_cursor ?
+            POLLIN | POLLRDNORM : 0;
+    if (!READ_ONCE(capture_task) || reader->msg_pos != reader->msg_len ||
+        smp_load_acquire(reader_head(reader)) != reader->cursor)
+        return POLLIN | POLLRDNORM;
+    return 0;
+ }
+
+ // Map the sample ring (struct accel_ring followed by the slots) into user
+ // space. The mapping is read-only, readers keep their cursors to themselves.
+ // VM_MAYWRITE is cleared as well, or a file opened O_RDWR to send commands
+ // could mprotect() the pages writable later on.
+ static int device_mmap(struct file *filp, struct vm_area_struct *vma)
+ {
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_ALIGN(ring_bytes))
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_vmalloc_range(vma, ring, 0);
+ }
+
+ static ssize_t device_write(struct file *filp, const char *buffer, size_t length, loff_t *offset)
+ {
+ 	size_t bytes;
+	bytes = length;
+    char command[MAX_SIZE];
+    int format_, gravity_;
+    int rate_;
+    uint8_t devid;
+    int range;
+    int samples;
+    char arg[MAX_SIZE], arg2[MAX_SIZE];
+    uint32_t centihz;
+    bool has_fraction;
+    uint8_t code;
+    int value;
+    int act_mg, inact_mg, inact_s;
+    int ff_mg, ff_ms;
+    uint8_t regs[3];
+    int err = 0;
+
+	if (bytes > MAX_SIZE - 1)	// can copy all at once, or not?
+		bytes = MAX_SIZE - 1;
+
+    mutex_lock(&accel_lock);
+
+    // The sensor belongs to the calibration or self-test job until it is finished
+    if (sensor_busy()){
+        mutex_unlock(&accel_lock);
+        return -EBUSY;
+    }
+
+	if (copy_from_user (accel_msg2, buffer, bytes) != 0)
+		printk (KERN_ERR "Error: copy_from_user unsuccessful");
+
+    accel_msg2[bytes] = '\0';
+    command[0] = '\0';
+    sscanf (accel_msg2, "%s", command);
+
+    //Check user input and perform actions
+    if (strcmp(command, "device") == 0){
+
+        if ((err = ADXL345_REG_READ(0x00, &devid)) == 0)
+            printk("The device ID is: 0x%X\n", devid);
+    }
+
+    else if (strcmp(command, "init") == 0){
+
+         // Write everything again rather than trusting the shadow
+         ADXL345_Shadow_Reset();
+         if ((err = ADXL345_Init()) == 0){
+             bw_rate = ADXL345_INIT_RATE;
+             mg_per_lsb_q8 = ADXL345_Scale_q8(ADXL345_INIT_FORMAT);
+             printk("The device has been initialized\n");
+         }
+    }
+
+    else if (strcmp(command, "calibrate") == 0){
+
+        // "calibrate [samples]" queues calibrate_work and returns immediately
+        samples = cal_samples;
+        sscanf(accel_msg2, "calibrate %d", &samples);
+        if (capture_task)
+            err = -EBUSY;
+        else if (samples < 1 || samples > CAL_MAX_SAMPLES)
+            err = -EINVAL;
+        else {
+            cal_total = samples;
+            cal_done = 0;
+            cal_state = CAL_RUNNING;
+            schedule_work(&calibrate_work);
+        }
+    }
+
+    else if (strcmp(command, "selftest") == 0){
+
+        // "selftest" queues selftest_work, results in /sys/class/accel/accel/selftest
+        if (capture_task)
+            err = -EBUSY;
+        else {
+            test_step = 0;
+            test_state = CAL_RUNNING;
+            schedule_work(&selftest_work);
+        }
+    }
+
+    else if (sscanf(accel_msg2, "capture %s", arg) == 1){
+
+        // "capture on" streams samples into the mmap ring, "capture auto" only
+        // while the board moves, "capture off" stops
+        if (strcmp(arg, "on") == 0)
+            err = capture_start(false);
+        else if (strcmp(arg, "auto") == 0)
+            err = capture_start(true);
+        else if (strcmp(arg, "off") == 0)
+            err = capture_stop();
+        else
+            err = -EINVAL;
+        // Closing the input device no longer stops what this command set up
+        if (err == 0)
+            input_started = false;
+    }
+
+    else if (sscanf(accel_msg2, "activity %d %d %d", &act_mg, &inact_mg, &inact_s) == 3){
+
+        // "activity <mg> <mg> <s>": what counts as motion for "capture auto", and how
+        // long the board has to stay below the second threshold to go to sleep.
+        // Both thresholds are AC coupled (ADXL345_Init sets ACT_INACT_CTL).
+        if (act_mg < ACT_MG_MIN || act_mg > ACT_MG_MAX ||
+            inact_mg < ACT_MG_MIN || inact_mg > ACT_MG_MAX ||
+            inact_s < 1 || inact_s > 255)
+            err = -EINVAL;
+        else {
+            regs[0] = (act_mg * 10 + 312) / 625;
+            regs[1] = (inact_mg * 10 + 312) / 625;
+            regs[2] = inact_s;
+            err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_THRESH_ACT, regs, 3);
+        }
+    }
+
+    else if (sscanf(accel_msg2, "freefall %d %d", &ff_mg, &ff_ms) == 2){
+
+        // "freefall <mg> <ms>": FREEFALL when all three axes stay below <mg> for
+        // <ms>. The datasheet suggests 300 to 600 mg and 100 to 350 ms.
+        if (ff_mg < ACT_MG_MIN || ff_mg > ACT_MG_MAX || ff_ms < 5 || ff_ms > FF_MS_MAX)
+            err = -EINVAL;
+        else {
+            regs[0] = (ff_mg * 10 + 312) / 625;
+            regs[1] = (ff_ms + 2) / 5;
+            err = ADXL345_REG_WRITE_MULTI(ADXL345_REG_THRESH_FF, regs, 2);
+        }
+    }
+
+    else if (sscanf(accel_msg2, "tilt %d", &value) == 1){
+
+        // "tilt <degrees>": a TILT event each time pitch or roll moved this far
+        // since the last ORIENT or TILT event, 0 for orientation changes only
+        if (value < 0 || value > 90)
+            err = -EINVAL;
+        else
+            orient.tilt_step = value * 100;
+    }
+
+    else if (strcmp(command, "filter") == 0){
+
+        // "filter hp|lp <shift>", "filter avg <samples>" or "filter off"
+        samples = sscanf(accel_msg2, "filter %s %d", arg, &value);
+        if (samples == 2 && strcmp(arg, "hp") == 0 && value >= 0 && value <= FILTER_MAX_SHIFT)
+            filter.hp_shift = value;
+        else if (samples == 2 && strcmp(arg, "lp") == 0 && value >= 0 && value <= FILTER_MAX_SHIFT)
+            filter.lp_shift = value;
+        else if (samples == 2 && strcmp(arg, "avg") == 0 && value >= 1 && value <= FILTER_MAX_AVG)
+            filter.avg_len = value;
+        else if (samples >= 1 && strcmp(arg, "off") == 0){
+            filter.hp_shift = 0;
+            filter.lp_shift = 0;
+            filter.avg_len = 1;
+            filter.decimate = 1;
+        }
+        else
+            err = -EINVAL;
+        if (err == 0)
+            Filter_Reset(&filter);
+    }
+
+    else if (sscanf(accel_msg2, "decimate %d", &value) == 1){
+
+        if (value >= 1 && value <= FILTER_MAX_DECIMATE){
+            filter.decimate = value;
+            Filter_Reset(&filter);
+        }
+        else
+            err = -EINVAL;
+    }
+
+    else if (sscanf(accel_msg2, "format %d %d", &format_, &gravity_) == 2){
+
+
+        range = -1;
+        switch(gravity_){
+            case 2:
+                range = XL345_RANGE_2G;
+               break;
+            case 4:
+                range = XL345_RANGE_4G;
+               break;
+            case 8:
+                range = XL345_RANGE_8G;
+               break;
+            case 16:
+                range = XL345_RANGE_16G;
+               break;
+        }
+
+        if (range < 0 || (format_ != 0 && format_ != 1))
+            err = -EINVAL;
+
+        else if (format_ == 0){
+
+            if ((err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_10BIT | range)) == 0){
+                mg_per_lsb_q8 = ADXL345_Scale_q8(XL345_10BIT | range);
+                printk("The device resolution is set to 10 bits\n");
+            }
+        }
+
+        else if (format_ == 1){
+
+            if ((err = ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_FULL_RESOLUTION | range)) == 0){
+                mg_per_lsb_q8 = ADXL345_Scale_q8(XL345_FULL_RESOLUTION | range);
+                printk("The device resolution is set to full\n");
+            }
+        }
+
+    }
+
+    else if ((value = sscanf(accel_msg2, "rate %s %s", arg, arg2)) >= 1){
+
+        // "rate <Hz> [lowpower]", any rate from 3200 down to 0.10 Hz. Low power
+        // mode is only available from 12.5 Hz to 400 Hz.
+        if (value == 1)
+            arg2[0] = '\0';
+        if ((err = parse_centi(arg, &centihz, &has_fraction)) == 0 &&
+            (err = ADXL345_Rate_Code(centihz, has_fraction)) >= 0){
+            rate_ = err;
+            code = rate_table[rate_].code;
+            err = 0;
+
+            if (strcmp(arg2, "lowpower") == 0){
+                if (code < XL345_RATE_12_5 || code > XL345_RATE_400)
+                    err = -EINVAL;
+                code |= XL345_LOW_POWER;
+            }
+            else if (arg2[0] != '\0')
+                err = -EINVAL;
+
+            if (err == 0 && (err = ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, code)) == 0){
+                // The capture thread paces itself from the output data rate
+                bw_rate = code;
+                if (rate_table[rate_].centihz > RATE_FIFO_ONLY_CENTIHZ && !capture_task)
+                    printk("accel: above 400 Hz use \"capture on\", read() only returns the latest sample\n");
+            }
+        }
+
+    }
+
+    mutex_unlock(&accel_lock);
+
+    if (err < 0)
+        return err;
+
+    return bytes;
+}
+
+
+
+
+
+
+ MODULE_LICENSE("GPL");
+ module_init (start_accel);
+ module_exit (stop_accel);
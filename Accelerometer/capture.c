@@ -0,0 +1,180 @@
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#include "ADXL345.h"
+#include "capture.h"
+
+// How long to sleep after a drain that started at start until the next batch is
+// due: one sample period if every_sample, else CAPTURE_WATERMARK of them. At
+// 1600 Hz and up the drain itself takes a good part of that, so it is counted.
+unsigned int Capture_Sleep_us(uint8_t rate, bool every_sample, ktime_t start){
+    int64_t due_us = (int64_t) ADXL345_Period_us(rate) * (every_sample ? 1 : CAPTURE_WATERMARK);
+    int64_t left_us = due_us - ktime_us_delta(ktime_get(), start);
+
+    return clamp(left_us, (int64_t) CAPTURE_MIN_SLEEP_US, (int64_t) CAPTURE_MAX_SLEEP_US);
+}
+
+// Drain the FIFO (stream mode, filled at rate) into xyz[] and date the entries
+// on clock, see ADXL345_Clock_Batch(); time[] gets each one's conversion time.
+// *int_source holds the INT_SOURCE bits read with the batch and *sleep_us how
+// long to wait for the next one (Capture_Sleep_us). Returns the number of
+// entries, or an error with none.
+int Capture_Drain(struct adxl345_clock *clock, uint8_t rate, bool every_sample,
+    int16_t xyz[][3], int64_t time[], uint8_t *int_source, unsigned int *sleep_us){
+    ktime_t start = ktime_get();
+    int n, i;
+
+    *int_source = 0;
+    n = ADXL345_FIFO_Read(xyz, XL345_FIFO_DEPTH, int_source);
+    time[0] = ADXL345_Clock_Batch(clock, ktime_to_ns(start), max(n, 0), *int_source & XL345_OVERRUN, rate);
+    for (i = 1; i < n; i++)
+        time[i] = time[i - 1] + clock->period_ns;
+    *sleep_us = Capture_Sleep_us(rate, every_sample, start);
+    return n;
+}
+
+// While "capture auto" is idle: read INT_SOURCE into *int_source and on ACTIVITY
+// restart the FIFO and the clock. Whatever the FIFO collected at the wake-up rate
+// is dropped so the new segment starts with fresh samples. Returns 1 once awake,
+// 0 while still idle, or an error.
+int Capture_Check_Wake(struct adxl345_clock *clock, uint8_t *int_source){
+    int err;
+
+    if ((err = ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, int_source)) < 0)
+        return err;
+    if (!(*int_source & XL345_ACTIVITY))
+        return 0;
+    if ((err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS)) < 0 ||
+        (err = ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK)) < 0)
+        return err;
+    ADXL345_Clock_Reset(clock);
+    return 1;
+}
+
+// Forget the filter history, e.g. after the configuration changed
+void Filter_Reset(struct accel_filter *filter){
+
+    memset(filter->hp_state, 0, sizeof(filter->hp_state));
+    memset(filter->lp_state, 0, sizeof(filter->lp_state));
+    memset(filter->avg_hist, 0, sizeof(filter->avg_hist));
+    memset(filter->avg_sum, 0, sizeof(filter->avg_sum));
+    filter->avg_pos = 0;
+    filter->avg_recip = ((1 << 16) + filter->avg_len / 2) / filter->avg_len;
+    filter->dec_count = 0;
+    filter->primed = false;
+}
+
+// Run one FIFO batch through the pipeline into out[] and return how many samples
+// are left after decimation; keep[] holds the index in the batch each one came
+// from. The batch itself is left as it was. Each stage is a plain loop over one
+// axis of the batch so the compiler can keep the state in registers.
+int Filter_Run(struct accel_filter *filter, int16_t batch[][3], int16_t out[][3], int keep[], int n){
+    int32_t v[XL345_FIFO_DEPTH];
+    int axis, i, kept, pos;
+
+    if (n == 0)
+        return 0;
+
+    if (!filter->primed){
+        // Start the IIRs at the first sample rather than at zero to avoid a step
+        for (axis = 0; axis < 3; axis++){
+            filter->hp_state[axis] = batch[0][axis] * 256;
+            filter->lp_state[axis] = batch[0][axis] * 256;
+        }
+        filter->primed = true;
+    }
+
+    for (axis = 0; axis < 3; axis++){
+        for (i = 0; i < n; i++)
+            v[i] = batch[i][axis];
+
+        // High-pass: subtract a slow one-pole low-pass of the input
+        if (filter->hp_shift){
+            int32_t s = filter->hp_state[axis];
+            for (i = 0; i < n; i++){
+                s += (v[i] * 256 - s) >> filter->hp_shift;
+                v[i] -= s >> 8;
+            }
+            filter->hp_state[axis] = s;
+        }
+
+        // Low-pass: one-pole IIR, y += (x - y) / 2^lp_shift
+        if (filter->lp_shift){
+            int32_t s = filter->lp_state[axis];
+            for (i = 0; i < n; i++){
+                s += (v[i] * 256 - s) >> filter->lp_shift;
+                v[i] = s >> 8;
+            }
+            filter->lp_state[axis] = s;
+        }
+
+        // Moving average over the last avg_len samples using a running sum
+        if (filter->avg_len > 1){
+            int32_t sum = filter->avg_sum[axis];
+            int32_t *hist = filter->avg_hist[axis];
+            pos = filter->avg_pos;
+            for (i = 0; i < n; i++){
+                sum += v[i] - hist[pos];
+                hist[pos] = v[i];
+                if (++pos == filter->avg_len)
+                    pos = 0;
+                v[i] = (int32_t) (((int64_t) sum * filter->avg_recip + (1 << 15)) >> 16);
+            }
+            filter->avg_sum[axis] = sum;
+        }
+
+        for (i = 0; i < n; i++)
+            out[i][axis] = clamp(v[i], -32768, 32767);
+    }
+    if (filter->avg_len > 1)
+        filter->avg_pos = (filter->avg_pos + n) % filter->avg_len;
+
+    // Decimation: keep one sample out of every decimate
+    for (i = 0, kept = 0; i < n; i++){
+        if (++filter->dec_count < filter->decimate)
+            continue;
+        filter->dec_count = 0;
+        out[kept][0] = out[i][0];
+        out[kept][1] = out[i][1];
+        out[kept][2] = out[i][2];
+        keep[kept++] = i;
+    }
+    return kept;
+}
+
+// Append one sample, overwriting the oldest one. The slot is filled before head
+// is published so a reader that sees the new head also sees the data. Readers
+// never hold the producer back; see Capture_Ring_Fetch() for how they detect
+// being lapped.
+void Capture_Ring_Push(struct capture_ring *ring, const struct accel_sample *sample){
+    uint32_t head = ring->head;
+
+    ring->data[head & (ring->size - 1)] = *sample;
+    smp_store_release(&ring->head, head + 1);
+}
+
+// Copy the sample at *cursor, which is not head, and advance the cursor. A
+// cursor more than a ring behind first skips to the oldest slot that is not
+// being rewritten, and *lost gets how many samples it skipped. Returns false if
+// the slot was overwritten while it was copied; the next call then skips ahead.
+bool Capture_Ring_Fetch(const struct capture_ring *ring, uint32_t *cursor, uint32_t *lost,
+    struct accel_sample *sample){
+    uint32_t head = smp_load_acquire(&ring->head);
+
+    *lost = 0;
+    if (head - *cursor >= ring->size){
+        *lost = head - *cursor - ring->size + 1;
+        *cursor = head - ring->size + 1;
+    }
+
+    *sample = ring->data[*cursor & (ring->size - 1)];
+    smp_rmb();
+    if (READ_ONCE(ring->head) - *cursor >= ring->size)
+        return false;
+
+    (*cursor)++;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef ACCELEROMETER_CAPTURE_H_
+#define ACCELEROMETER_CAPTURE_H_
+
+/* The capture thread's work that does not depend on the kernel around it:
+ * draining and dating FIFO batches and pacing the next drain, "capture auto"
+ * wake-up checks, the filter pipeline and the sample rings. The driver and the
+ * host simulator (sim/) both run this code. */
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include "ADXL345.h"
+#include "accel.h"
+
+// FIFO watermark, the capture thread wakes up about this many samples apart
+#define CAPTURE_WATERMARK 16
+#define CAPTURE_MIN_SLEEP_US 1000
+#define CAPTURE_MAX_SLEEP_US 100000
+
+// "capture auto": link mode makes ACTIVITY and INACTIVITY alternate, and
+// AUTO_SLEEP drops the ADXL345 to its 8 Hz wake-up rate after INACTIVITY. The
+// capture thread then stops draining the FIFO and only looks at INT_SOURCE
+// once per wake-up period until ACTIVITY, so only active segments reach the ring.
+#define AUTO_IDLE_POLL_US 100000        // a little under one 8 Hz wake-up period
+#define AUTO_POWER_CTL (XL345_ACT_INACT_SERIAL | XL345_AUTO_SLEEP | XL345_MEASURE | XL345_WAKEUP_8HZ)
+
+int Capture_Drain(struct adxl345_clock *clock, uint8_t rate, bool every_sample,
+    int16_t xyz[][3], int64_t time[], uint8_t *int_source, unsigned int *sleep_us);
+unsigned int Capture_Sleep_us(uint8_t rate, bool every_sample, ktime_t start);
+int Capture_Check_Wake(struct adxl345_clock *clock, uint8_t *int_source);
+
+// Fixed-point pipeline that makes the filtered stream out of the captured
+// samples: high-pass, low-pass, moving average, then keep one sample out of every
+// decimate. The IIR states are kept in Q8 so long time constants keep their
+// fraction. Configured with the "filter" and "decimate" commands.
+#define FILTER_MAX_SHIFT 15
+#define FILTER_MAX_AVG 64
+#define FILTER_MAX_DECIMATE 3200
+
+struct accel_filter {
+    int hp_shift;                           // high-pass corner as 2^-hp_shift, 0 = off
+    int lp_shift;                           // low-pass corner as 2^-lp_shift, 0 = off
+    int avg_len;                            // moving-average window, 1 = off
+    int decimate;                           // keep one sample out of decimate
+    bool primed;                            // IIR states hold a real sample
+    int32_t hp_state[3];
+    int32_t lp_state[3];
+    int32_t avg_hist[3][FILTER_MAX_AVG];
+    int32_t avg_sum[3];
+    int avg_pos;
+    uint32_t avg_recip;                     // 2^16 / avg_len
+    int dec_count;
+};
+
+void Filter_Reset(struct accel_filter *filter);
+int Filter_Run(struct accel_filter *filter, int16_t batch[][3], int16_t out[][3], int keep[], int n);
+
+// A ring of size slots, a power of two, with one producer and any number of
+// readers that each keep their own cursor. head counts every sample pushed.
+struct capture_ring {
+    struct accel_sample *data;
+    uint32_t size;
+    uint32_t head;
+};
+
+void Capture_Ring_Push(struct capture_ring *ring, const struct accel_sample *sample);
+bool Capture_Ring_Fetch(const struct capture_ring *ring, uint32_t *cursor, uint32_t *lost,
+    struct accel_sample *sample);
+
+#endif /*ACCELEROMETER_CAPTURE_H_*/
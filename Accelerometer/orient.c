@@ -0,0 +1,153 @@
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include "ADXL345.h"
+#include "orient.h"
+
+// atan(i / 64) in hundredths of a degree, i = 0..64. Linear interpolation
+// between entries is good to about 0.01 degree.
+#define ATAN_STEPS 64
+#define ATAN_FRAC_BITS 10               // Q16 ratio = 6 index bits + 10 fraction bits
+
+static const uint16_t atan_table[ATAN_STEPS + 1] = {
+       0,   90,  179,  268,  358,  447,  536,  624,
+     713,  800,  888,  975, 1062, 1148, 1234, 1319,
+    1404, 1488, 1571, 1653, 1735, 1817, 1897, 1977,
+    2056, 2134, 2211, 2287, 2363, 2438, 2511, 2584,
+    2657, 2728, 2798, 2867, 2936, 3003, 3070, 3136,
+    3201, 3264, 3327, 3390, 3451, 3511, 3571, 3629,
+    3687, 3744, 3800, 3855, 3909, 3963, 4016, 4067,
+    4119, 4169, 4218, 4267, 4315, 4363, 4409, 4455,
+    4500,
+};
+
+// atan2(y, x) in hundredths of a degree, -18000 to 18000. The smaller of |x|
+// and |y| over the larger gives an angle in the first octant, which is then
+// mirrored into place. No division by zero and no 64 bit arithmetic.
+int Orient_Atan2(int32_t y, int32_t x){
+    uint32_t ax = x < 0 ? -(uint32_t) x : (uint32_t) x;
+    uint32_t ay = y < 0 ? -(uint32_t) y : (uint32_t) y;
+    uint32_t num, den, t, i, frac;
+    int angle;
+
+    if (ax == 0 && ay == 0)
+        return 0;
+
+    num = min(ax, ay);
+    den = max(ax, ay);
+    while (den >= 1 << 16){             // keep num << 16 within 32 bits
+        num >>= 1;
+        den >>= 1;
+    }
+    t = (num << 16) / den;
+    i = t >> ATAN_FRAC_BITS;
+    frac = t & ((1 << ATAN_FRAC_BITS) - 1);
+    angle = atan_table[i];
+    if (i < ATAN_STEPS)
+        angle += ((atan_table[i + 1] - atan_table[i]) * frac + (1 << (ATAN_FRAC_BITS - 1))) >> ATAN_FRAC_BITS;
+
+    if (ay > ax)
+        angle = 9000 - angle;
+    if (x < 0)
+        angle = 18000 - angle;
+    return y < 0 ? -angle : angle;
+}
+
+void Orient_Reset(struct orient_state *st){
+    int tilt_step = st->tilt_step;
+
+    memset(st, 0, sizeof(*st));
+    st->orientation = ACCEL_ORIENT_UNKNOWN;
+    st->tilt_step = tilt_step;
+}
+
+// Face pointing up from the axis carrying most of gravity. The current face is
+// kept until another one leads it by ORIENT_HYST_MG, so a board held near 45
+// degrees does not flip back and forth on noise.
+static int orient_classify(const int32_t mg[3], int current){
+    int best = 0, axis, candidate;
+    int32_t along;
+
+    for (axis = 1; axis < 3; axis++)
+        if (abs(mg[axis]) > abs(mg[best]))
+            best = axis;
+    if (abs(mg[best]) < ORIENT_MIN_MG)
+        return current;
+
+    candidate = ACCEL_ORIENT_X_UP + 2 * best + (mg[best] < 0);
+    if (current == ACCEL_ORIENT_UNKNOWN || candidate == current)
+        return candidate;
+
+    // Gravity along the current face, negative if it turned over
+    axis = (current - ACCEL_ORIENT_X_UP) / 2;
+    along = (current - ACCEL_ORIENT_X_UP) & 1 ? -mg[axis] : mg[axis];
+    return abs(mg[best]) - along > ORIENT_HYST_MG ? candidate : current;
+}
+
+static void orient_event(struct orient_state *st, struct accel_event *ev, int type){
+
+    ev->type = type;
+    ev->orientation = st->orientation;
+    ev->pitch = st->pitch;
+    ev->roll = st->roll;
+    ev->seq = 0;
+}
+
+// The events the ADXL345 raises on its own: taps, and FREEFALL once per fall
+// (the part keeps raising it until the fall ends). Dated with the last angles,
+// so it also works for INT_SOURCE bits read without a sample.
+int Orient_Interrupts(struct orient_state *st, uint8_t int_source, struct accel_event ev[ORIENT_MAX_EVENTS]){
+    int n = 0;
+
+    if ((int_source & XL345_FREEFALL) && !st->falling){
+        st->falling = true;
+        orient_event(st, &ev[n++], ACCEL_EV_FREEFALL);
+    }
+    if (int_source & XL345_DOUBLETAP)
+        orient_event(st, &ev[n++], ACCEL_EV_DOUBLE_TAP);
+    else if (int_source & XL345_SINGLETAP)
+        orient_event(st, &ev[n++], ACCEL_EV_TAP);
+    return n;
+}
+
+// Feed one sample (whole milli-g) and the INT_SOURCE bits that came with it.
+// Fills ev with what changed and returns how many events there are: those of
+// Orient_Interrupts(), then ORIENT when the face up changed, else TILT when
+// pitch or roll moved tilt_step away from the last reported angles.
+int Orient_Update(struct orient_state *st, const int32_t mg[3], uint8_t int_source,
+    struct accel_event ev[ORIENT_MAX_EVENTS]){
+    int orientation, n;
+    int32_t d_pitch, d_roll;
+    uint32_t yz;
+
+    // During freefall and hard shakes the angles would be noise: keep the last ones
+    yz = int_sqrt((uint32_t) (mg[1] * mg[1]) + (uint32_t) (mg[2] * mg[2]));
+    if (yz + abs(mg[0]) >= ORIENT_MIN_MG){
+        st->pitch = Orient_Atan2(mg[0], yz);
+        st->roll = Orient_Atan2(mg[1], mg[2]);
+        st->falling = false;
+    }
+
+    n = Orient_Interrupts(st, int_source, ev);
+
+    orientation = orient_classify(mg, st->orientation);
+    d_pitch = st->pitch - st->pitch_sent;
+    d_roll = st->roll - st->roll_sent;
+    if (d_roll > 18000)
+        d_roll -= 36000;
+    else if (d_roll < -18000)
+        d_roll += 36000;
+
+    if (orientation != st->orientation){
+        st->orientation = orientation;
+        orient_event(st, &ev[n++], ACCEL_EV_ORIENT);
+    }
+    else if (st->tilt_step && (abs(d_pitch) >= st->tilt_step || abs(d_roll) >= st->tilt_step))
+        orient_event(st, &ev[n++], ACCEL_EV_TILT);
+    else
+        return n;
+
+    st->pitch_sent = st->pitch;
+    st->roll_sent = st->roll;
+    return n;
+}
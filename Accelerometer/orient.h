@@ -0,0 +1,31 @@
+#ifndef ACCELEROMETER_ORIENT_H_
+#define ACCELEROMETER_ORIENT_H_
+
+/* Orientation, tilt and freefall events computed from captured samples.
+ * Angles are in hundredths of a degree. Pitch is the X axis above (+) or below
+ * (-) the horizon, roll the rotation about X with 0 lying flat face up. */
+
+#include <linux/types.h>
+#include "accel.h"
+
+// Orient_Update() raises at most FREEFALL, a tap and ORIENT or TILT for a sample
+#define ORIENT_MAX_EVENTS 3
+
+#define ORIENT_MIN_MG 500           // below this |a| the direction of gravity is not trusted
+#define ORIENT_HYST_MG 200          // a new face has to lead the current one by this much
+
+struct orient_state {
+    int orientation;                // ACCEL_ORIENT_*
+    int pitch, roll;                // latest sample
+    int pitch_sent, roll_sent;      // as of the last ORIENT or TILT event
+    int tilt_step;                  // TILT once pitch or roll moved this far, 0 = off
+    bool falling;                   // FREEFALL reported, gravity not back yet
+};
+
+int Orient_Atan2(int32_t y, int32_t x);
+void Orient_Reset(struct orient_state *st);
+int Orient_Interrupts(struct orient_state *st, uint8_t int_source, struct accel_event ev[ORIENT_MAX_EVENTS]);
+int Orient_Update(struct orient_state *st, const int32_t mg[3], uint8_t int_source,
+    struct accel_event ev[ORIENT_MAX_EVENTS]);
+
+#endif /*ACCELEROMETER_ORIENT_H_*/
@@ -0,0 +1,747 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/mutex.h>
+#include "sim.h"
+#include "../address_map_arm.h"
+#include "../ADXL345.h"
+#include "../orient.h"
+#include "../capture.h"
+
+/* Host test and benchmark for ADXL345.c and capture.c against the I2C0 and
+ * ADXL345 models.
+ *
+ *   make -C Accelerometer/sim check      run the tests (exit status 1 on failure)
+ *   ./accel_sim -v                       same, with the driver's printk output
+ *
+ * The capture loops below only do the sleeping: draining, dating and pacing are
+ * capture_thread's own Capture_Drain() and Capture_Check_Wake(). The capture
+ * benchmark reports what each output data rate costs on the bus and how many
+ * samples are lost.
+ * orient.c is checked against libm and fed from the models like orient_run();
+ * the filter pipeline, the sample ring, calibration and the self-test run as
+ * the driver calls them. */
+
+static int failures;
+
+// Stands in for accel_lock around calibration and the self-test
+static DEFINE_MUTEX(sim_lock);
+
+#define CHECK(cond) do { \
+    if (!(cond)){ \
+        printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+// Bring the controller and the part up the way start_accel() does
+static void setup(void){
+
+    sim_reset();
+    memset(&I2C0_Stats, 0, sizeof(I2C0_Stats));
+    ADXL345_Shadow_Reset();                 // a fresh part
+    Pinmux_Config();
+    CHECK(I2C0_Init() == 0);
+    CHECK(ADXL345_Init() == 0);
+    CHECK(ADXL345_TAP() == 0);
+}
+
+static void test_init(void){
+    uint8_t devid = 0;
+
+    setup();
+    CHECK(sim_sysmgr[SYSMGR_I2C0USEFPGA] == 0);
+    CHECK(sim_sysmgr[SYSMGR_GENERALIO7] == 1 && sim_sysmgr[SYSMGR_GENERALIO8] == 1);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &devid) == 0);
+    CHECK(devid == 0xE5);
+    CHECK(adxl345_sim_reg(ADXL345_REG_BW_RATE) == ADXL345_INIT_RATE);
+    CHECK(adxl345_sim_reg(ADXL345_REG_DATA_FORMAT) == ADXL345_INIT_FORMAT);
+    CHECK(ADXL345_Scale_q8(ADXL345_INIT_FORMAT) == 8000);                       // 31.25 mg
+    CHECK(ADXL345_Scale_q8(XL345_RANGE_2G | XL345_10BIT) == 1000);             // 3.9 mg
+    CHECK(adxl345_sim_reg(ADXL345_REG_POWER_CTL) == XL345_MEASURE);
+}
+
+static void test_registers(void){
+    uint8_t value = 0;
+    int16_t xyz[3];
+
+    setup();
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_OFSX, 0x7f) == 0);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_OFSX, &value) == 0 && value == 0x7f);
+
+    // Read only registers ignore writes
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_DEVID, 0x12) == 0);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &value) == 0 && value == 0xE5);
+
+    // 1g on Z at +-16g, 10 bit is 32 LSB; wait for a conversion first
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_OFSX, 0) == 0);
+    sim_advance(2 * ADXL345_Period_us(ADXL345_INIT_RATE) * 1000ULL);
+    CHECK(ADXL345_XYZ_Read(xyz) == 0);
+    CHECK(xyz[0] == 0 && xyz[1] == 0 && xyz[2] == 32);
+}
+
+static void test_tap(void){
+    uint8_t int_source = 0;
+
+    setup();
+    adxl345_sim_tap(true);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &int_source) == 0);
+    CHECK((int_source & (XL345_SINGLETAP | XL345_DOUBLETAP)) == (XL345_SINGLETAP | XL345_DOUBLETAP));
+    CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &int_source) == 0);
+    CHECK((int_source & (XL345_SINGLETAP | XL345_DOUBLETAP)) == 0);
+}
+
+// Configuration reads and repeated writes stay off the bus, bursts only carry
+// what changed, and a failed write is not trusted
+static void test_shadow(void){
+    static const uint8_t timing[3] = { 0x1F, 0x0F, 0xEF }, longer[3] = { 0x1F, 0x20, 0xEF };
+    uint64_t transfers, bytes;
+    uint8_t value = 0;
+
+    sim_reset();
+    memset(&I2C0_Stats, 0, sizeof(I2C0_Stats));
+    ADXL345_Shadow_Reset();
+    Pinmux_Config();
+    CHECK(I2C0_Init() == 0);
+    CHECK(ADXL345_Init() == 0);
+    CHECK(i2c0_sim_stats.transfers == 5);   // was 8 one register at a time
+
+    transfers = i2c0_sim_stats.transfers;
+    CHECK(ADXL345_REG_READ(ADXL345_REG_BW_RATE, &value) == 0 && value == ADXL345_INIT_RATE);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, ADXL345_INIT_FORMAT) == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers && I2C0_Stats.shadow_hits == 2);
+
+    // Burst: one transfer, and only the changed middle register the second time
+    CHECK(ADXL345_REG_WRITE_MULTI(ADXL345_REG_DUR, timing, 3) == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers + 1);
+    CHECK(adxl345_sim_reg(ADXL345_REG_DUR) == 0x1F && adxl345_sim_reg(ADXL345_REG_LATENT) == 0x0F &&
+        adxl345_sim_reg(ADXL345_REG_WINDOW) == 0xEF);
+    bytes = i2c0_sim_stats.bytes;
+    CHECK(ADXL345_REG_WRITE_MULTI(ADXL345_REG_DUR, longer, 3) == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers + 2);
+    CHECK(i2c0_sim_stats.bytes - bytes == 3);   // address, pointer, LATENT
+    CHECK(adxl345_sim_reg(ADXL345_REG_LATENT) == 0x20);
+    CHECK(ADXL345_REG_WRITE_MULTI(ADXL345_REG_DUR, longer, 3) == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers + 2);
+
+    // Data and status registers always go to the part
+    CHECK(ADXL345_REG_READ(ADXL345_REG_INT_SOURCE, &value) == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers + 3);
+
+    // After a NACK the register is read back from the part
+    i2c0_sim_nack = 1;
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_OFSX, 5) == -EIO);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_OFSX, &value) == 0 && value == 0);
+    CHECK(i2c0_sim_stats.transfers == transfers + 4);
+}
+
+// A NACK aborts the transfer with -EIO and the next one goes through
+static void test_nack(void){
+    uint8_t devid = 0;
+
+    setup();
+    i2c0_sim_nack = 1;
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &devid) == -EIO);
+    CHECK(i2c0_sim_stats.aborts == 1 && I2C0_Stats.aborts == 1);
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &devid) == 0 && devid == 0xE5);
+}
+
+// A stuck bus times out, and the controller recovers once it is released
+static void test_wedge(void){
+    uint64_t start;
+    uint8_t devid = 0;
+
+    setup();
+    i2c0_sim_wedged = true;
+    start = sim_time_ns;
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &devid) == -ETIMEDOUT);
+    CHECK(sim_time_ns - start < 50000000ULL);
+    CHECK(I2C0_Stats.timeouts == 1);
+    i2c0_sim_wedged = false;
+    CHECK(ADXL345_REG_READ(ADXL345_REG_DEVID, &devid) == 0 && devid == 0xE5);
+}
+
+struct capture_result {
+    uint64_t delivered;         // samples handed to the caller
+    uint64_t gaps;              // missing ramp values seen by the caller
+    uint64_t overrun_batches;   // batches that came with OVERRUN set
+    uint64_t batches;
+};
+
+// Run the capture_thread loop for duration_ns of simulated time. fixed_us, if
+// not 0, replaces the pacing of Capture_Drain() with a fixed sleep.
+static void capture(uint8_t rate, uint32_t fixed_us, uint64_t duration_ns, struct capture_result *r){
+    int16_t batch[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    struct adxl345_clock clock;
+    uint8_t int_source;
+    uint64_t end;
+    unsigned int sleep_us;
+    int prev = 0;                   // the ramp starts at 1 with the stats
+    int n, i;
+
+    memset(r, 0, sizeof(*r));
+    // Passing through bypass empties the FIFO of the previous run
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_BYPASS) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, rate) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK) == 0);
+    adxl345_sim_ramp = true;
+    adxl345_sim_stats = (struct adxl345_sim_stats) { 0 };
+    i2c0_sim_stats = (struct i2c0_sim_stats) { 0 };
+    memset(&I2C0_Stats, 0, sizeof(I2C0_Stats));
+    ADXL345_Clock_Reset(&clock);
+
+    sleep_us = fixed_us ? fixed_us : Capture_Sleep_us(rate, false, ktime_get());
+    end = sim_time_ns + duration_ns;
+    while (sim_time_ns < end){
+        sim_usleep_range(sleep_us, sleep_us + sleep_us / 4);
+        n = Capture_Drain(&clock, rate, false, batch, time, &int_source, &sleep_us);
+        if (fixed_us)
+            sleep_us = fixed_us;
+        CHECK(n >= 0);
+        for (i = 0; i < n; i++){
+            r->gaps += (batch[i][0] - prev - 1) & 0x1ff;
+            prev = batch[i][0];
+        }
+        r->delivered += n > 0 ? n : 0;
+        r->batches++;
+        if (int_source & XL345_OVERRUN)
+            r->overrun_batches++;
+    }
+    adxl345_sim_ramp = false;
+}
+
+// "capture auto" as capture_thread runs it: drain until INACTIVITY, then only
+// poll INT_SOURCE every AUTO_IDLE_POLL_US until Capture_Check_Wake() sees ACTIVITY
+struct auto_result {
+    uint64_t delivered;
+    uint64_t sleeps;
+    uint64_t wakeups;
+    bool idle;
+};
+
+static void capture_auto(uint8_t rate, uint64_t duration_ns, struct auto_result *r){
+    int16_t batch[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    struct adxl345_clock clock;
+    uint8_t int_source;
+    uint64_t end = sim_time_ns + duration_ns;
+    unsigned int sleep_us = Capture_Sleep_us(rate, false, ktime_get());
+    int n;
+
+    ADXL345_Clock_Reset(&clock);
+    while (sim_time_ns < end){
+        if (r->idle){
+            sim_usleep_range(AUTO_IDLE_POLL_US, AUTO_IDLE_POLL_US + AUTO_IDLE_POLL_US / 4);
+            n = Capture_Check_Wake(&clock, &int_source);
+            CHECK(n >= 0);
+            if (n > 0){
+                r->idle = false;
+                r->wakeups++;
+            }
+            continue;
+        }
+
+        sim_usleep_range(sleep_us, sleep_us + sleep_us / 4);
+        n = Capture_Drain(&clock, rate, false, batch, time, &int_source, &sleep_us);
+        CHECK(n >= 0);
+        r->delivered += n > 0 ? n : 0;
+        if (int_source & XL345_INACTIVITY){
+            r->idle = true;
+            r->sleeps++;
+        }
+    }
+}
+
+// "capture auto" at 100 Hz as capture_start() sets it up
+static void auto_setup(void){
+
+    setup();
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_100) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_INT_ENABLE,
+        XL345_SINGLETAP | XL345_DOUBLETAP | XL345_ACTIVITY | XL345_INACTIVITY) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, AUTO_POWER_CTL) == 0);
+}
+
+// 100 Hz with the board moving for 1 s out of every 9 (ADXL345_Init thresholds:
+// 250 mg activity, 125 mg for 2 s inactivity). Returns the bus bytes used.
+static uint64_t run_autosleep(struct auto_result *r){
+    int phase;
+
+    auto_setup();
+    memset(r, 0, sizeof(*r));
+    i2c0_sim_stats = (struct i2c0_sim_stats) { 0 };
+
+    for (phase = 0; phase < 4; phase++){
+        adxl345_sim_shake_mg = phase & 1 ? 0 : 500;
+        capture_auto(XL345_RATE_100, phase & 1 ? 8000000000ULL : 1000000000ULL, r);
+    }
+    adxl345_sim_shake_mg = 0;
+    return i2c0_sim_stats.bytes;
+}
+
+// Two still periods have to put the part to sleep and the shake in between has
+// to wake it; the bus is mostly quiet meanwhile
+static void test_autosleep(void){
+    struct capture_result c;
+    struct auto_result r;
+    uint64_t bytes = run_autosleep(&r);
+
+    CHECK(r.sleeps == 2 && r.wakeups == 1);
+    CHECK(r.delivered >= 500 && r.delivered <= 700);   // 1 + 2 + 1 + 2 s at 100 Hz
+
+    setup();
+    capture(XL345_RATE_100, 0, 18000000000ULL, &c);
+    CHECK(bytes * 2 < i2c0_sim_stats.bytes);
+}
+
+// A tap while the part sleeps shows up in the wake-up check that clears it,
+// without ACTIVITY, and becomes an event there and then
+static void test_idle_tap(void){
+    struct orient_state st = { .tilt_step = 500 };
+    struct accel_event ev[ORIENT_MAX_EVENTS];
+    struct adxl345_clock clock;
+    struct auto_result r;
+    uint8_t int_source = 0;
+
+    auto_setup();
+    memset(&r, 0, sizeof(r));
+    Orient_Reset(&st);
+    capture_auto(XL345_RATE_100, 3000000000ULL, &r);
+    CHECK(r.idle && r.sleeps == 1);
+
+    adxl345_sim_tap(true);
+    CHECK(Capture_Check_Wake(&clock, &int_source) == 0);
+    CHECK((int_source & (XL345_SINGLETAP | XL345_DOUBLETAP)) == (XL345_SINGLETAP | XL345_DOUBLETAP));
+    CHECK(Orient_Interrupts(&st, int_source, ev) == 1 && ev[0].type == ACCEL_EV_DOUBLE_TAP);
+    CHECK(Capture_Check_Wake(&clock, &int_source) == 0);
+    CHECK(Orient_Interrupts(&st, int_source, ev) == 0);
+}
+
+// Nothing may be lost at any rate, 3200 Hz keeping the bus two thirds busy,
+// and the model's drop count has to match the gaps the reader sees
+static void test_capture(void){
+    struct capture_result r;
+    uint8_t rate;
+
+    setup();
+    for (rate = XL345_RATE_12_5; rate <= XL345_RATE_3200; rate++){
+        capture(rate, 0, 2000000000ULL, &r);
+        CHECK(adxl345_sim_stats.dropped == 0);
+        CHECK(r.gaps == 0 && r.overrun_batches == 0);
+    }
+}
+
+// Sleeping for longer than the FIFO holds has to show up as OVERRUN and gaps
+static void test_overrun(void){
+    struct capture_result r;
+
+    setup();
+    capture(XL345_RATE_400, 2 * XL345_FIFO_DEPTH * ADXL345_Period_us(XL345_RATE_400), 1000000000ULL, &r);
+    CHECK(adxl345_sim_stats.dropped > 0);
+    CHECK(r.overrun_batches > 0);
+    CHECK(r.gaps == adxl345_sim_stats.dropped);
+    CHECK(r.delivered + adxl345_sim_stats.dropped + XL345_FIFO_DEPTH >= adxl345_sim_stats.samples);
+}
+
+// Date a capture at rate with the part's clock ppm off, the way capture_thread
+// does, and return the worst error against the model's conversion times once
+// the period has been measured for a while. Times have to keep increasing.
+static int64_t capture_timed(uint8_t rate, int ppm, uint64_t duration_ns){
+    int16_t batch[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    struct adxl345_clock clock;
+    uint64_t true_ns = ADXL345_Period_ns(rate) + (int64_t) ADXL345_Period_ns(rate) * ppm / 1000000;
+    uint64_t end, count = 0;
+    unsigned int sleep_us = Capture_Sleep_us(rate, false, ktime_get());
+    int64_t prev = INT64_MIN, error, worst = 0;
+    uint8_t int_source;
+    int n, i;
+
+    setup();
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, rate) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK) == 0);
+    adxl345_sim_odr_ppm = ppm;
+    adxl345_sim_stats = (struct adxl345_sim_stats) { 0 };
+    ADXL345_Clock_Reset(&clock);
+
+    end = sim_time_ns + duration_ns;
+    while (sim_time_ns < end){
+        sim_usleep_range(sleep_us, sleep_us * 5 / 4);
+        n = Capture_Drain(&clock, rate, false, batch, time, &int_source, &sleep_us);
+        CHECK(n >= 0 && !(int_source & XL345_OVERRUN));
+        for (i = 0; i < n; i++, count++){
+            CHECK(time[i] > prev);
+            prev = time[i];
+            error = time[i] - (int64_t) (adxl345_sim_stats.first_ns + count * true_ns);
+            if (count >= 4 * ADXL345_CLOCK_SETTLE && llabs(error) > worst)
+                worst = llabs(error);
+        }
+    }
+    CHECK(count > 0 && count == adxl345_sim_stats.popped);
+    return worst;
+}
+
+// Conversion times stay within half a period of the truth, plus the time it
+// takes to read FIFO_STATUS, with the part's clock 2% off either way and at a
+// fast and a slow rate
+#define TIMESTAMP_SLACK_NS  500000
+
+static void test_timestamps(void){
+    static const struct { uint8_t rate; int ppm; } runs[] = {
+        { XL345_RATE_100, 0 }, { XL345_RATE_100, 20000 }, { XL345_RATE_100, -20000 },
+        { XL345_RATE_800, 20000 }, { XL345_RATE_12_5, -20000 },
+    };
+    int64_t worst;
+    int i;
+
+    for (i = 0; i < (int) (sizeof(runs) / sizeof(runs[0])); i++){
+        worst = capture_timed(runs[i].rate, runs[i].ppm, 20000000000ULL);
+        if (sim_verbose)
+            printf("rate %x, %d ppm: worst error %lld ns\n", runs[i].rate, runs[i].ppm, (long long) worst);
+        CHECK(worst < (int64_t) ADXL345_Period_ns(runs[i].rate) / 2 + TIMESTAMP_SLACK_NS);
+    }
+}
+
+// Every direction on circles from 1 mg to 20 g, within 0.02 degree of libm
+static void test_atan2(void){
+    static const int radius[] = { 1, 7, 300, 1000, 16000, 20000 };
+    int worst = 0;
+
+    for (int r = 0; r < 6; r++)
+        for (int deg10 = -1800; deg10 <= 1800; deg10++){
+            double a = deg10 * M_PI / 1800;
+            int32_t x = lround(radius[r] * cos(a)), y = lround(radius[r] * sin(a));
+            int want = lround(atan2(y, x) * 18000 / M_PI);
+            int diff = abs(Orient_Atan2(y, x) - want);
+
+            if (x == 0 && y == 0)
+                continue;
+            if (diff > 18000)
+                diff = 36000 - diff;
+            if (diff > worst)
+                worst = diff;
+        }
+    CHECK(worst <= 2);
+    CHECK(Orient_Atan2(0, 0) == 0);
+    CHECK(Orient_Atan2(1000, 0) == 9000 && Orient_Atan2(-1000, 0) == -9000);
+    CHECK(Orient_Atan2(0, -1000) == 18000);
+}
+
+struct orient_result {
+    int count[ACCEL_EV_DOUBLE_TAP + 1];
+    struct accel_event last;
+    uint64_t last_ns;           // when the last event was raised
+};
+
+// Hold adxl345_sim_mg for duration_ns while draining the FIFO every sample
+// period, as capture_thread does while a file waits for events
+static void orient_hold(struct orient_state *st, uint64_t duration_ns, struct orient_result *r){
+    int16_t batch[XL345_FIFO_DEPTH][3];
+    int64_t time[XL345_FIFO_DEPTH];
+    struct adxl345_clock clock;
+    struct accel_event ev[ORIENT_MAX_EVENTS];
+    int32_t scale_q8 = ADXL345_Scale_q8(ADXL345_INIT_FORMAT), mg[3];
+    uint64_t end = sim_time_ns + duration_ns;
+    unsigned int sleep_us = ADXL345_Period_us(XL345_RATE_100);
+    uint8_t int_source;
+    int n, i, j, count;
+
+    ADXL345_Clock_Reset(&clock);
+    while (sim_time_ns < end){
+        sim_usleep_range(sleep_us, sleep_us * 5 / 4);
+        n = Capture_Drain(&clock, XL345_RATE_100, true, batch, time, &int_source, &sleep_us);
+        CHECK(n >= 0);
+        for (i = 0; i < n; i++){
+            for (j = 0; j < 3; j++)
+                mg[j] = (batch[i][j] * scale_q8 + 128) >> 8;
+            count = Orient_Update(st, mg, i == 0 ? int_source : 0, ev);
+            for (j = 0; j < count; j++){
+                r->count[ev[j].type]++;
+                r->last = ev[j];
+                r->last_ns = sim_time_ns;
+            }
+        }
+    }
+}
+
+// Flat, tilted, on its side, dropped and flat again: one event per change and
+// nothing while the board holds still
+static void test_orient(void){
+    struct orient_state st = { .tilt_step = 500 };
+    struct orient_result r;
+    uint64_t turned;
+
+    memset(&r, 0, sizeof(r));
+    setup();
+    CHECK(ADXL345_FreeFall() == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_100) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_FIFO_CTL, XL345_FIFO_MODE_STREAM | CAPTURE_WATERMARK) == 0);
+    Orient_Reset(&st);
+
+    orient_hold(&st, 500000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_ORIENT] == 1 && r.last.orientation == ACCEL_ORIENT_Z_UP);
+    CHECK(abs(r.last.pitch) < 200 && abs(r.last.roll) < 200);
+
+    // 20 degrees of roll: TILT, still face up
+    adxl345_sim_mg[1] = 342;
+    adxl345_sim_mg[2] = 940;
+    orient_hold(&st, 500000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_TILT] == 1 && r.count[ACCEL_EV_ORIENT] == 1);
+    CHECK(abs(r.last.roll - 2000) < 200);
+
+    // 40 degrees is not past the hysteresis yet, 60 degrees is
+    adxl345_sim_mg[1] = 643;
+    adxl345_sim_mg[2] = 766;
+    orient_hold(&st, 500000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_ORIENT] == 1);
+    adxl345_sim_mg[1] = 866;
+    adxl345_sim_mg[2] = 500;
+    turned = sim_time_ns;
+    orient_hold(&st, 500000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_ORIENT] == 2 && r.last.orientation == ACCEL_ORIENT_Y_UP);
+    CHECK(r.last_ns - turned <= 2 * ADXL345_Period_us(XL345_RATE_100) * 1000ULL);
+
+    // A 300 ms drop is one FREEFALL and no orientation change
+    r.count[ACCEL_EV_TILT] = 0;
+    adxl345_sim_mg[0] = adxl345_sim_mg[1] = adxl345_sim_mg[2] = 0;
+    orient_hold(&st, 300000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_FREEFALL] == 1 && r.count[ACCEL_EV_ORIENT] == 2 && r.count[ACCEL_EV_TILT] == 0);
+
+    adxl345_sim_mg[2] = -1000;
+    orient_hold(&st, 500000000ULL, &r);
+    CHECK(r.count[ACCEL_EV_ORIENT] == 3 && r.last.orientation == ACCEL_ORIENT_Z_DOWN);
+    CHECK(r.count[ACCEL_EV_FREEFALL] == 1);
+    adxl345_sim_mg[2] = 1000;
+}
+
+// Each stage of the filter pipeline on known input: a DC level passes the
+// low-pass and, once its window is full, the moving average unchanged; the
+// high-pass removes it and lets a step decay; decimation keeps one sample in
+// every decimate across batches. The batch itself is never written.
+static void test_filter(void){
+    struct accel_filter f = { .avg_len = 1, .decimate = 1 };
+    int16_t batch[XL345_FIFO_DEPTH][3], copy[XL345_FIFO_DEPTH][3], out[XL345_FIFO_DEPTH][3];
+    int keep[XL345_FIFO_DEPTH];
+    int i, n, kept;
+
+    for (i = 0; i < XL345_FIFO_DEPTH; i++){
+        batch[i][0] = 100;
+        batch[i][1] = -50;
+        batch[i][2] = 256;
+    }
+    memcpy(copy, batch, sizeof(copy));
+
+    f.lp_shift = 4;
+    f.avg_len = 8;
+    Filter_Reset(&f);
+    CHECK(f.avg_recip == 8192);
+    n = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    CHECK(n == XL345_FIFO_DEPTH && keep[0] == 0 && keep[n - 1] == n - 1);
+    CHECK(out[0][0] > 0 && out[0][0] < 100);    // the window starts empty
+    for (i = f.avg_len - 1; i < n; i++)
+        CHECK(out[i][0] == 100 && out[i][1] == -50 && out[i][2] == 256);
+    CHECK(memcmp(copy, batch, sizeof(copy)) == 0);
+
+    // The IIRs start at the first sample: no step through the high-pass
+    f = (struct accel_filter) { .hp_shift = 4, .avg_len = 1, .decimate = 1 };
+    Filter_Reset(&f);
+    n = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    for (i = 0; i < n; i++)
+        CHECK(out[i][0] == 0 && out[i][1] == 0 && out[i][2] == 0);
+    for (i = 0; i < XL345_FIFO_DEPTH; i++)
+        batch[i][0] = 200;
+    n = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    CHECK(out[0][0] > 90 && out[0][0] <= 100);
+    for (i = 0; i < 8; i++)
+        n = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    CHECK(abs(out[n - 1][0]) <= 1);
+
+    // decimate 5 over two batches of 32 keeps 6 + 6 samples
+    f = (struct accel_filter) { .avg_len = 1, .decimate = 5 };
+    Filter_Reset(&f);
+    kept = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    CHECK(kept == 6 && keep[0] == 4 && keep[5] == 29);
+    kept = Filter_Run(&f, batch, out, keep, XL345_FIFO_DEPTH);
+    CHECK(kept == 6 && keep[0] == 2 && keep[5] == 27);
+    CHECK(Filter_Run(&f, batch, out, keep, 0) == 0);
+
+    Filter_Reset(&f);
+    CHECK(!f.primed && f.dec_count == 0 && f.decimate == 5);
+}
+
+// A reader more than a ring behind skips to the oldest slot that is not about
+// to be rewritten and is told how many samples it lost; one within the ring
+// loses nothing
+static void test_ring(void){
+    struct accel_sample data[8], sample;
+    struct capture_ring ring = { .data = data, .size = 8 };
+    uint32_t cursor = 0, lost = 0, total = 0;
+    int64_t prev;
+    int i;
+
+    for (i = 0; i < 2 * 8 + 3; i++){
+        memset(&sample, 0, sizeof(sample));
+        sample.time_ns = i;
+        Capture_Ring_Push(&ring, &sample);
+    }
+    CHECK(ring.head == 19);
+
+    CHECK(Capture_Ring_Fetch(&ring, &cursor, &lost, &sample));
+    CHECK(lost == ring.head - ring.size + 1 && sample.time_ns == 12 && cursor == 13);
+    total = lost;
+    for (prev = sample.time_ns; cursor != ring.head; prev = sample.time_ns){
+        CHECK(Capture_Ring_Fetch(&ring, &cursor, &lost, &sample));
+        CHECK(lost == 0 && sample.time_ns == prev + 1);
+        total += lost + 1;
+    }
+    CHECK(total + 1 == ring.head);
+
+    cursor = 15;
+    CHECK(Capture_Ring_Fetch(&ring, &cursor, &lost, &sample));
+    CHECK(lost == 0 && sample.time_ns == 15 && cursor == 16);
+}
+
+// A board lying flat with some bias reads (0, 0, 1 g) after ADXL345_Calibrate(),
+// and the rate and format the user had are back
+static void test_calibrate(void){
+    int16_t average[3];
+    int8_t ofs[3];
+    int done = 0;
+
+    setup();
+    adxl345_sim_mg[0] = 40;
+    adxl345_sim_mg[1] = -70;
+    adxl345_sim_mg[2] = 1030;
+    CHECK(ADXL345_Calibrate(&sim_lock, 32, &done, ofs) == 0);
+    CHECK(done == 32 && !sim_lock.locked);
+    CHECK(ofs[0] < 0 && ofs[1] > 0 && ofs[2] < 0);
+    CHECK((int8_t) adxl345_sim_reg(ADXL345_REG_OFSX) == ofs[0] &&
+        (int8_t) adxl345_sim_reg(ADXL345_REG_OFSY) == ofs[1] &&
+        (int8_t) adxl345_sim_reg(ADXL345_REG_OFSZ) == ofs[2]);
+    CHECK(adxl345_sim_reg(ADXL345_REG_BW_RATE) == ADXL345_INIT_RATE);
+    CHECK(adxl345_sim_reg(ADXL345_REG_DATA_FORMAT) == ADXL345_INIT_FORMAT);
+    CHECK(adxl345_sim_reg(ADXL345_REG_POWER_CTL) == XL345_MEASURE);
+
+    // Within half an offset LSB (2 LSB of 3.9 mg) plus rounding
+    mutex_lock(&sim_lock);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_BW_RATE, XL345_RATE_100) == 0);
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_DATA_FORMAT, XL345_RANGE_16G | XL345_FULL_RESOLUTION) == 0);
+    CHECK(ADXL345_Sample_Average(&sim_lock, 2, 8, average, NULL) == 0);
+    mutex_unlock(&sim_lock);
+    CHECK(abs(average[0]) <= 3 && abs(average[1]) <= 3 && abs(average[2] - 256) <= 3);
+
+    // No DATA_READY: a timeout, and the lock is let go
+    setup();
+    CHECK(ADXL345_REG_WRITE(ADXL345_REG_POWER_CTL, XL345_STANDBY) == 0);
+    mutex_lock(&sim_lock);
+    CHECK(ADXL345_Sample_Average(&sim_lock, 0, 4, average, NULL) == -ETIMEDOUT);
+    mutex_unlock(&sim_lock);
+}
+
+// The self-test deflection of a part that works is within the limits, one that
+// does not move fails, and the limits themselves are inclusive
+static void test_selftest(void){
+    static const int16_t low[3] = { 89, -89, 110 }, high[3] = { 955, -955, 1286 };
+    static const int16_t under[3] = { 88, -89, 110 }, over[3] = { 955, -955, 1287 };
+    int16_t delta[3];
+
+    setup();
+    mutex_lock(&sim_lock);
+    CHECK(ADXL345_Self_Test_Delta(&sim_lock, delta) == 0);
+    mutex_unlock(&sim_lock);
+    CHECK(ADXL345_Self_Test_Pass(delta));
+    CHECK(abs(delta[0] - 384) <= 2 && abs(delta[1] + 384) <= 2 && abs(delta[2] - 589) <= 2);
+    CHECK(!(adxl345_sim_reg(ADXL345_REG_DATA_FORMAT) & XL345_SELFTEST));
+
+    setup();
+    adxl345_sim_selftest_mg[0] = adxl345_sim_selftest_mg[1] = adxl345_sim_selftest_mg[2] = 0;
+    mutex_lock(&sim_lock);
+    CHECK(ADXL345_Self_Test_Delta(&sim_lock, delta) == 0);
+    mutex_unlock(&sim_lock);
+    CHECK(delta[0] == 0 && delta[1] == 0 && delta[2] == 0);
+    CHECK(!ADXL345_Self_Test_Pass(delta));
+
+    CHECK(ADXL345_Self_Test_Pass(low) && ADXL345_Self_Test_Pass(high));
+    CHECK(!ADXL345_Self_Test_Pass(under) && !ADXL345_Self_Test_Pass(over));
+}
+
+static void benchmark(void){
+    static const char *const rate_name[16] = {
+        "0.10", "0.20", "0.39", "0.78", "1.56", "3.13", "6.25", "12.5",
+        "25", "50", "100", "200", "400", "800", "1600", "3200",
+    };
+    struct capture_result r;
+    struct auto_result a;
+    uint64_t duration_ns = 2000000000ULL;
+    uint8_t rate;
+
+    setup();
+    printf("\ncapture benchmark, %.1f s simulated per rate, I2C0 at 400 kHz\n", duration_ns / 1e9);
+    printf("%8s %10s %8s %9s %9s %11s %9s %9s %9s\n",
+        "ODR Hz", "samples/s", "dropped", "bus busy", "bytes/smp", "batches/s", "avg batch",
+        "xfer avg", "xfer max");
+    for (rate = XL345_RATE_12_5; rate <= XL345_RATE_3200; rate++){
+        capture(rate, 0, duration_ns, &r);
+        printf("%8s %10.1f %8llu %8.1f%% %9.1f %11.1f %9.1f %7lluus %7uus\n",
+            rate_name[rate],
+            r.delivered / (duration_ns / 1e9),
+            (unsigned long long) adxl345_sim_stats.dropped,
+            100.0 * i2c0_sim_stats.busy_ns / duration_ns,
+            r.delivered ? (double) i2c0_sim_stats.bytes / r.delivered : 0.0,
+            r.batches / (duration_ns / 1e9),
+            r.batches ? (double) r.delivered / r.batches : 0.0,
+            (unsigned long long) (I2C0_Stats.time_us.count ? I2C0_Stats.time_us.sum_us / I2C0_Stats.time_us.count : 0),
+            I2C0_Stats.time_us.max_us);
+    }
+
+    run_autosleep(&a);
+    printf("\ncapture auto at 100 Hz, moving 2 s out of 18 s: %llu samples, %llu bus bytes, %llu sleeps\n",
+        (unsigned long long) a.delivered, (unsigned long long) i2c0_sim_stats.bytes, (unsigned long long) a.sleeps);
+    setup();
+    capture(XL345_RATE_100, 0, 18000000000ULL, &r);
+    printf("capture on  at 100 Hz, same 18 s:              %llu samples, %llu bus bytes\n",
+        (unsigned long long) r.delivered, (unsigned long long) i2c0_sim_stats.bytes);
+}
+
+int main(int argc, char **argv){
+    bool bench = true;
+
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "-v") == 0)
+            sim_verbose = true;
+        else if (strcmp(argv[i], "-q") == 0)
+            bench = false;
+        else {
+            fprintf(stderr, "usage: %s [-v] [-q]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    test_init();
+    test_registers();
+    test_tap();
+    test_shadow();
+    test_nack();
+    test_wedge();
+    test_capture();
+    test_overrun();
+    test_autosleep();
+    test_idle_tap();
+    test_timestamps();
+    test_atan2();
+    test_orient();
+    test_filter();
+    test_ring();
+    test_calibrate();
+    test_selftest();
+    if (bench)
+        benchmark();
+
+    printf("%s (%d failures)\n", failures ? "FAILED" : "OK", failures);
+    return failures ? 1 : 0;
+}
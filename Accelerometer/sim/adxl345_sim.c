@@ -0,0 +1,384 @@
+#include <stdint.h>
+#include "sim.h"
+#include "../ADXL345.h"
+
+/* ADXL345 on I2C: register file with auto-increment, conversions at the
+ * BW_RATE output data rate while POWER_CTL has MEASURE set, and the 32 entry
+ * FIFO in bypass, FIFO and stream mode. A multi-byte read latches the output
+ * registers at the START and pops one FIFO entry at the STOP, like the part.
+ * Activity and inactivity detection follow ACT_INACT_CTL; in link mode they
+ * alternate and AUTO_SLEEP drops conversions to the wake-up rate between
+ * INACTIVITY and ACTIVITY. FREE_FALL is raised on every conversion once all
+ * axes have stayed below THRESH_FF for TIME_FF. SELF_TEST in DATA_FORMAT adds
+ * adxl345_sim_selftest_mg to the input. Only right justified data is modelled. */
+
+#define NEVER               UINT64_MAX
+#define OFS_UG_PER_LSB      15600       // offset registers, 15.6 mg per LSB
+#define ACT_UG_PER_LSB      62500       // THRESH_ACT/THRESH_INACT/THRESH_FF, 62.5 mg per LSB
+#define FF_NS_PER_LSB       5000000ULL  // TIME_FF, 5 ms per LSB
+
+struct adxl345_sim_stats adxl345_sim_stats;
+int adxl345_sim_mg[3];
+int adxl345_sim_shake_mg;
+bool adxl345_sim_ramp;
+int adxl345_sim_odr_ppm;
+int adxl345_sim_selftest_mg[3];
+
+static uint8_t regs[0x40];
+static uint8_t pointer;
+static bool expect_pointer;                 // next written byte is the register address
+static bool data_read;                      // output registers read in this transfer
+static uint8_t latched[6];                  // DATAX0..DATAZ1 as of the START
+
+static int16_t fifo[XL345_FIFO_DEPTH][3];
+static int fifo_head, fifo_count;
+static int16_t output[3];                   // output registers once the FIFO is empty
+static bool overrun;
+static uint8_t events;                      // latched tap/activity bits of INT_SOURCE
+
+static uint64_t next_sample;
+
+// Activity/inactivity detection
+static bool detect_started;                 // references taken from the first sample
+static bool act_armed, inact_armed;
+static int act_ref[3], inact_ref[3];        // AC coupling references in mg
+static uint64_t still_since;
+static uint64_t falling_since;              // all axes below THRESH_FF since, NEVER if not
+static bool sleeping;                       // AUTO_SLEEP: converting at the wake-up rate
+
+void adxl345_sim_reset(void){
+    for (int i = 0; i < 0x40; i++)
+        regs[i] = 0;
+    regs[ADXL345_REG_DEVID] = 0xE5;
+    regs[ADXL345_REG_BW_RATE] = XL345_RATE_100;
+    pointer = 0;
+    expect_pointer = data_read = false;
+    fifo_head = fifo_count = 0;
+    output[0] = output[1] = output[2] = 0;
+    overrun = false;
+    events = 0;
+    next_sample = NEVER;
+    adxl345_sim_mg[0] = adxl345_sim_mg[1] = 0;
+    adxl345_sim_mg[2] = 1000;
+    adxl345_sim_shake_mg = 0;
+    adxl345_sim_ramp = false;
+    adxl345_sim_odr_ppm = 0;
+    adxl345_sim_selftest_mg[0] = 1500;      // about the middle of the limits at 3.3 V
+    adxl345_sim_selftest_mg[1] = -1500;
+    adxl345_sim_selftest_mg[2] = 2300;
+    detect_started = sleeping = false;
+    falling_since = NEVER;
+    adxl345_sim_stats = (struct adxl345_sim_stats) { 0 };
+}
+
+static uint64_t period_ns(void){
+    uint64_t period;
+
+    if (sleeping)
+        return 125000000ULL << (regs[ADXL345_REG_POWER_CTL] & 0x03);
+    period = 312500ULL << (XL345_RATE_3200 - (regs[ADXL345_REG_BW_RATE] & 0x0F));
+    return period + (int64_t) period * adxl345_sim_odr_ppm / 1000000;
+}
+
+static uint8_t fifo_mode(void){
+
+    return regs[ADXL345_REG_FIFO_CTL] & XL345_FIFO_MODE_TRIGGER;
+}
+
+// Acceleration on one axis for this conversion; shaking alternates on X
+static int input_mg(int axis){
+
+    if (axis == 0 && adxl345_sim_shake_mg)
+        return adxl345_sim_mg[0] + (adxl345_sim_stats.samples & 1 ? adxl345_sim_shake_mg : -adxl345_sim_shake_mg);
+    return adxl345_sim_mg[axis];
+}
+
+// True if any axis enabled in ACT_INACT_CTL (X at mask, Y at mask >> 1, Z at
+// mask >> 2) is more than thresh away from ref (AC) or zero (DC)
+static bool above(const int mg[3], const int ref[3], uint8_t thresh, uint8_t mask, bool ac){
+    int64_t limit = (int64_t) thresh * ACT_UG_PER_LSB;
+
+    for (int axis = 0; axis < 3; axis++){
+        int64_t ug = (mg[axis] - (ac ? ref[axis] : 0)) * 1000LL;
+
+        if ((regs[ADXL345_REG_ACT_INACT_CTL] & (mask >> axis)) && (ug > limit || ug < -limit))
+            return true;
+    }
+    return false;
+}
+
+static void detect_freefall(const int mg[3]){
+    int64_t limit = (int64_t) regs[ADXL345_REG_THRESH_FF] * ACT_UG_PER_LSB;
+    bool low = true;
+
+    for (int axis = 0; axis < 3; axis++)
+        if (mg[axis] * 1000LL >= limit || mg[axis] * -1000LL >= limit)
+            low = false;
+    if (!low){
+        falling_since = NEVER;
+        return;
+    }
+    if (falling_since == NEVER)
+        falling_since = sim_time_ns;
+    if ((regs[ADXL345_REG_INT_ENABLE] & XL345_FREEFALL) &&
+        sim_time_ns - falling_since >= regs[ADXL345_REG_TIME_FF] * FF_NS_PER_LSB)
+        events |= XL345_FREEFALL;
+}
+
+static void detect(const int mg[3]){
+    uint8_t ctl = regs[ADXL345_REG_ACT_INACT_CTL];
+    uint8_t enable = regs[ADXL345_REG_INT_ENABLE];
+    uint8_t power = regs[ADXL345_REG_POWER_CTL];
+    bool link = power & XL345_ACT_INACT_SERIAL;
+
+    detect_freefall(mg);
+
+    if (!detect_started){
+        for (int axis = 0; axis < 3; axis++)
+            act_ref[axis] = inact_ref[axis] = mg[axis];
+        act_armed = inact_armed = true;
+        still_since = sim_time_ns;
+        detect_started = true;
+    }
+
+    if ((enable & XL345_ACTIVITY) && act_armed &&
+        above(mg, act_ref, regs[ADXL345_REG_THRESH_ACT], 0x40, ctl & 0x80)){
+        events |= XL345_ACTIVITY;
+        sleeping = false;
+        if (link){
+            act_armed = false;
+            inact_armed = true;
+            still_since = sim_time_ns;
+            for (int axis = 0; axis < 3; axis++)
+                inact_ref[axis] = mg[axis];
+        }
+    }
+
+    if ((enable & XL345_INACTIVITY) && inact_armed){
+        if (above(mg, inact_ref, regs[ADXL345_REG_THRESH_INACT], 0x04, ctl & 0x08)){
+            still_since = sim_time_ns;
+            for (int axis = 0; axis < 3; axis++)
+                inact_ref[axis] = mg[axis];
+        }
+        else if (sim_time_ns - still_since >= regs[ADXL345_REG_TIME_INACT] * 1000000000ULL){
+            events |= XL345_INACTIVITY;
+            if (link){
+                inact_armed = false;
+                act_armed = true;
+                for (int axis = 0; axis < 3; axis++)
+                    act_ref[axis] = mg[axis];
+                sleeping = power & XL345_AUTO_SLEEP;
+            }
+        }
+    }
+}
+
+// One conversion in the current DATA_FORMAT, offsets and self-test force applied
+static int16_t convert(const int mg[3], int axis){
+    uint8_t format = regs[ADXL345_REG_DATA_FORMAT];
+    int range_g = 2 << (format & 0x03);
+    int64_t ug = mg[axis] * 1000LL + (int8_t) regs[ADXL345_REG_OFSX + axis] * OFS_UG_PER_LSB;
+    int64_t lsb, limit;
+
+    if (format & XL345_SELFTEST)
+        ug += adxl345_sim_selftest_mg[axis] * 1000LL;
+
+    if (format & XL345_FULL_RESOLUTION){
+        lsb = ug * 256 / 1000000;
+        limit = 256 * range_g;
+    }
+    else {
+        lsb = ug * 512 / (range_g * 1000000LL);
+        limit = 512;
+    }
+    if (lsb >= limit)
+        lsb = limit - 1;
+    if (lsb < -limit)
+        lsb = -limit;
+    return lsb;
+}
+
+static void sample(void){
+    int16_t xyz[3];
+    int mg[3];
+    int slot;
+
+    if (adxl345_sim_stats.samples++ == 0)
+        adxl345_sim_stats.first_ns = sim_time_ns;
+    for (int axis = 0; axis < 3; axis++)
+        mg[axis] = input_mg(axis);
+    detect(mg);
+
+    if (adxl345_sim_ramp){
+        xyz[0] = adxl345_sim_stats.samples & 0x1ff;
+        xyz[1] = 0;
+        xyz[2] = convert(mg, 2);
+    }
+    else
+        for (int axis = 0; axis < 3; axis++)
+            xyz[axis] = convert(mg, axis);
+
+    if (fifo_mode() == XL345_FIFO_MODE_BYPASS){
+        // Only the output registers: unread data is replaced
+        if (fifo_count > 0){
+            overrun = true;
+            adxl345_sim_stats.dropped++;
+        }
+        fifo_head = fifo_count = 0;
+    }
+    else if (fifo_count == XL345_FIFO_DEPTH){
+        overrun = true;
+        adxl345_sim_stats.dropped++;
+        if (fifo_mode() != XL345_FIFO_MODE_STREAM)
+            return;                         // FIFO and trigger mode stop collecting
+        fifo_head = (fifo_head + 1) % XL345_FIFO_DEPTH;
+        fifo_count--;
+    }
+    slot = (fifo_head + fifo_count++) % XL345_FIFO_DEPTH;
+    fifo[slot][0] = xyz[0];
+    fifo[slot][1] = xyz[1];
+    fifo[slot][2] = xyz[2];
+}
+
+static void pop(void){
+
+    if (fifo_count == 0)
+        return;
+    output[0] = fifo[fifo_head][0];
+    output[1] = fifo[fifo_head][1];
+    output[2] = fifo[fifo_head][2];
+    fifo_head = (fifo_head + 1) % XL345_FIFO_DEPTH;
+    fifo_count--;
+    adxl345_sim_stats.popped++;
+    if (fifo_mode() != XL345_FIFO_MODE_BYPASS)
+        overrun = false;
+}
+
+static uint8_t int_source(void){
+    uint8_t value = events;
+    int samples = regs[ADXL345_REG_FIFO_CTL] & XL345_FIFO_SAMPLES_MASK;
+
+    if (fifo_count > 0)
+        value |= XL345_DATAREADY;
+    if (fifo_mode() != XL345_FIFO_MODE_BYPASS && fifo_count >= samples)
+        value |= XL345_WATERMARK;
+    if (overrun)
+        value |= XL345_OVERRUN;
+    return value;
+}
+
+uint8_t adxl345_sim_reg(int reg){
+
+    return regs[reg & 0x3f];
+}
+
+static uint8_t read_reg(uint8_t reg){
+    uint8_t value;
+
+    switch (reg){
+    case ADXL345_REG_INT_SOURCE:
+        value = int_source();
+        events = 0;                         // reading clears all but the data bits
+        if (fifo_mode() == XL345_FIFO_MODE_BYPASS)
+            overrun = false;
+        return value;
+    case ADXL345_REG_DATAX0 ... ADXL345_REG_DATAZ1:
+        data_read = true;
+        return latched[reg - ADXL345_REG_DATAX0];
+    case ADXL345_REG_FIFO_STATUS:
+        return fifo_mode() == XL345_FIFO_MODE_BYPASS ? 0 : fifo_count;
+    default:
+        return regs[reg];
+    }
+}
+
+static void write_reg(uint8_t reg, uint8_t value){
+
+    switch (reg){
+    case ADXL345_REG_DEVID:
+    case ADXL345_REG_INT_SOURCE:
+    case ADXL345_REG_DATAX0 ... ADXL345_REG_DATAZ1:
+    case ADXL345_REG_FIFO_STATUS:
+        return;                             // read only
+    case ADXL345_REG_POWER_CTL:
+        if ((value & XL345_MEASURE) && !(regs[reg] & XL345_MEASURE)){
+            // Detection starts over from the next conversion
+            detect_started = sleeping = false;
+            regs[reg] = value;
+            next_sample = sim_time_ns + period_ns();
+        }
+        else if (!(value & XL345_MEASURE))
+            next_sample = NEVER;
+        break;
+    case ADXL345_REG_FIFO_CTL:
+        if ((value & XL345_FIFO_MODE_TRIGGER) != fifo_mode()){
+            fifo_head = fifo_count = 0;
+            overrun = false;
+        }
+        break;
+    }
+    regs[reg] = value;
+}
+
+bool adxl345_sim_start(int addr, bool read){
+
+    if (addr != ADXL345_SIM_ADDR)
+        return false;
+    expect_pointer = !read;
+    if (read){
+        const int16_t *out = fifo_count > 0 ? fifo[fifo_head] : output;
+
+        for (int axis = 0; axis < 3; axis++){
+            latched[2 * axis] = out[axis] & 0xff;
+            latched[2 * axis + 1] = (uint16_t) out[axis] >> 8;
+        }
+    }
+    return true;
+}
+
+bool adxl345_sim_write_byte(uint8_t value){
+
+    if (expect_pointer){
+        pointer = value & 0x3f;
+        expect_pointer = false;
+    }
+    else
+        write_reg(pointer++ & 0x3f, value);
+    return true;
+}
+
+uint8_t adxl345_sim_read_byte(void){
+
+    return read_reg(pointer++ & 0x3f);
+}
+
+void adxl345_sim_stop(void){
+
+    if (data_read)
+        pop();
+    data_read = false;
+}
+
+// A tap on the board sets SINGLE_TAP (and DOUBLE_TAP) if detection is set up
+void adxl345_sim_tap(bool double_tap){
+    uint8_t enable = regs[ADXL345_REG_INT_ENABLE];
+
+    if (!(regs[ADXL345_REG_TAP_AXES] & 0x07) || !regs[ADXL345_REG_THRESH_TAP] || !regs[ADXL345_REG_DUR])
+        return;
+    events |= enable & XL345_SINGLETAP;
+    if (double_tap)
+        events |= enable & XL345_DOUBLETAP;
+}
+
+uint64_t adxl345_sim_next_event(void){
+
+    return next_sample;
+}
+
+void adxl345_sim_step(uint64_t now){
+
+    while (next_sample <= now){
+        sample();
+        next_sample += period_ns();
+    }
+}
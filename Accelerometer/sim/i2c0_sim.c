@@ -0,0 +1,272 @@
+#include <stdint.h>
+#include "sim.h"
+#include "../address_map_arm.h"
+
+/* DesignWare I2C0 as configured on the HPS: master only, 7 bit addressing,
+ * 64 entry TX (command) and RX FIFOs, 100 MHz ic_clk. A command leaves the TX
+ * FIFO once the bus has had time to clock it out: 9 SCL periods per byte plus
+ * an address byte and a START for a new direction or RESTART, and one more SCL
+ * period for a STOP. The SCL period comes from FS_SCL_HCNT/LCNT. */
+
+#define FIFO_DEPTH          64
+#define IC_CLK_NS           10
+
+#define CMD_READ            0x100
+#define CMD_STOP            0x200
+#define CMD_RESTART         0x400
+
+// RAW_INTR_STAT bits
+#define INTR_RX_UNDER       0x01
+#define INTR_RX_OVER        0x02
+#define INTR_TX_OVER        0x08
+#define INTR_TX_ABRT        0x40
+
+// TX_ABRT_SOURCE bits
+#define ABRT_7B_ADDR_NOACK  0x01
+#define ABRT_TXDATA_NOACK   0x08
+#define ABRT_USER_ABRT      0x10000
+
+// STATUS bits
+#define STATUS_ACTIVITY     0x01
+#define STATUS_TFNF         0x02
+#define STATUS_TFE          0x04
+#define STATUS_RFNE         0x08
+#define STATUS_RFF          0x10
+#define STATUS_MST_ACTIVITY 0x20
+
+#define NEVER               UINT64_MAX
+
+struct i2c0_sim_stats i2c0_sim_stats;
+int i2c0_sim_nack;
+bool i2c0_sim_wedged;
+
+static uint32_t regs[I2C0_SPAN / 4];        // plain read/write registers
+static uint16_t tx[FIFO_DEPTH];
+static int tx_head, tx_count;
+static uint8_t rx[FIFO_DEPTH];
+static int rx_head, rx_count;
+static uint32_t raw_intr, abrt_source;
+
+static bool enabled, enable_target;
+static uint64_t enable_at;                  // when ENABLE_STATUS follows ENABLE
+
+static bool active;                         // START sent, no STOP yet
+static bool dir_read;                       // direction of the current transfer
+static uint64_t head_done;                  // when the head command completes
+static uint64_t head_ns;                    // bus time of the head command
+
+void i2c0_sim_reset(void){
+    for (int i = 0; i < I2C0_SPAN / 4; i++)
+        regs[i] = 0;
+    regs[I2C0_TAR] = 0x55;
+    tx_head = tx_count = rx_head = rx_count = 0;
+    raw_intr = abrt_source = 0;
+    enabled = enable_target = false;
+    enable_at = NEVER;
+    active = dir_read = false;
+    i2c0_sim_nack = 0;
+    i2c0_sim_wedged = false;
+    i2c0_sim_stats = (struct i2c0_sim_stats) { 0 };
+}
+
+static uint64_t scl_ns(void){
+    uint32_t count = regs[I2C0_FS_SCL_HCNT] + regs[I2C0_FS_SCL_LCNT];
+
+    return count ? count * IC_CLK_NS : 2500;
+}
+
+static bool needs_address(uint16_t cmd){
+
+    return !active || (cmd & CMD_RESTART) || !!(cmd & CMD_READ) != dir_read;
+}
+
+// Bus time for the command now at the head of the TX FIFO
+static void schedule_head(uint64_t start){
+    uint16_t cmd = tx[tx_head];
+
+    head_ns = 9 * scl_ns();
+    if (needs_address(cmd))
+        head_ns += 10 * scl_ns();           // (RE)START and the address byte
+    if (cmd & CMD_STOP)
+        head_ns += scl_ns();
+    head_done = start + head_ns;
+}
+
+static void flush_tx(void){
+
+    tx_head = tx_count = 0;
+}
+
+static void end_transfer(void){
+
+    if (active)
+        adxl345_sim_stop();
+    active = false;
+}
+
+static void tx_abort(uint32_t source){
+
+    raw_intr |= INTR_TX_ABRT;
+    abrt_source |= source;
+    flush_tx();
+    end_transfer();
+    i2c0_sim_stats.aborts++;
+}
+
+static void execute(uint16_t cmd){
+    bool read = cmd & CMD_READ;
+    bool ack;
+
+    if (needs_address(cmd)){
+        i2c0_sim_stats.bytes++;
+        if (i2c0_sim_nack > 0){
+            i2c0_sim_nack--;
+            ack = false;
+        }
+        else
+            ack = adxl345_sim_start(regs[I2C0_TAR] & 0x3ff, read);
+        if (!ack){
+            tx_abort(ABRT_7B_ADDR_NOACK);
+            return;
+        }
+        active = true;
+        dir_read = read;
+    }
+
+    i2c0_sim_stats.bytes++;
+    if (read){
+        uint8_t value = adxl345_sim_read_byte();
+
+        if (rx_count < FIFO_DEPTH)
+            rx[(rx_head + rx_count++) % FIFO_DEPTH] = value;
+        else
+            raw_intr |= INTR_RX_OVER;
+    }
+    else if (!adxl345_sim_write_byte(cmd & 0xff)){
+        tx_abort(ABRT_TXDATA_NOACK);
+        return;
+    }
+
+    if (cmd & CMD_STOP){
+        end_transfer();
+        i2c0_sim_stats.transfers++;
+    }
+}
+
+uint64_t i2c0_sim_next_event(void){
+    uint64_t t = enable_at;
+
+    if (tx_count > 0 && enabled && !i2c0_sim_wedged && head_done < t)
+        t = head_done;
+    return t;
+}
+
+void i2c0_sim_step(uint64_t now){
+
+    if (enable_at <= now){
+        enabled = enable_target;
+        enable_at = NEVER;
+        if (!enabled){
+            // Disabling flushes both FIFOs and clears the interrupt status
+            flush_tx();
+            rx_count = 0;
+            raw_intr = abrt_source = 0;
+            end_transfer();
+        }
+        else if (tx_count > 0)
+            schedule_head(now);
+    }
+
+    while (tx_count > 0 && enabled && !i2c0_sim_wedged && head_done <= now){
+        uint16_t cmd = tx[tx_head];
+        uint64_t done = head_done;
+
+        tx_head = (tx_head + 1) % FIFO_DEPTH;
+        tx_count--;
+        i2c0_sim_stats.busy_ns += head_ns;
+        execute(cmd);
+        if (tx_count > 0)
+            schedule_head(done);
+    }
+}
+
+uint32_t i2c0_sim_read(int reg){
+    uint32_t value;
+
+    switch (reg){
+    case I2C0_DATA_CMD:
+        if (rx_count == 0){
+            raw_intr |= INTR_RX_UNDER;
+            return 0;
+        }
+        value = rx[rx_head];
+        rx_head = (rx_head + 1) % FIFO_DEPTH;
+        rx_count--;
+        return value;
+    case I2C0_RAW_INTR_STAT:
+        return raw_intr;
+    case I2C0_CLR_INTR:
+        raw_intr = abrt_source = 0;
+        return 0;
+    case I2C0_CLR_TX_ABRT:
+        raw_intr &= ~INTR_TX_ABRT;
+        abrt_source = 0;
+        return 0;
+    case I2C0_STATUS:
+        value = 0;
+        if (active || tx_count > 0)
+            value |= STATUS_ACTIVITY | STATUS_MST_ACTIVITY;
+        if (tx_count < FIFO_DEPTH)
+            value |= STATUS_TFNF;
+        if (tx_count == 0)
+            value |= STATUS_TFE;
+        if (rx_count > 0)
+            value |= STATUS_RFNE;
+        if (rx_count == FIFO_DEPTH)
+            value |= STATUS_RFF;
+        return value;
+    case I2C0_TXFLR:
+        return tx_count;
+    case I2C0_RXFLR:
+        return rx_count;
+    case I2C0_TX_ABRT_SOURCE:
+        return abrt_source;
+    case I2C0_ENABLE_STATUS:
+        return enabled;
+    default:
+        return regs[reg];
+    }
+}
+
+void i2c0_sim_write(int reg, uint32_t value){
+
+    switch (reg){
+    case I2C0_DATA_CMD:
+        // The TX FIFO stays flushed until the abort is cleared
+        if (!enabled || (raw_intr & INTR_TX_ABRT))
+            return;
+        if (tx_count == FIFO_DEPTH){
+            raw_intr |= INTR_TX_OVER;
+            return;
+        }
+        tx[(tx_head + tx_count++) % FIFO_DEPTH] = value & 0x7ff;
+        if (tx_count == 1)
+            schedule_head(sim_time_ns);
+        break;
+    case I2C0_ENABLE:
+        regs[reg] = value & 1;
+        if ((value & 2) && enabled){
+            // ABORT: STOP after the current byte and flush the commands
+            flush_tx();
+            end_transfer();
+            raw_intr |= INTR_TX_ABRT;
+            abrt_source |= ABRT_USER_ABRT;
+        }
+        enable_target = value & 1;
+        enable_at = enable_target != enabled ? sim_time_ns + 2 * scl_ns() : NEVER;
+        break;
+    default:
+        regs[reg] = value;
+        break;
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef SIM_ASM_BARRIER_H_
+#define SIM_ASM_BARRIER_H_
+
+// Host stand-in for <asm/barrier.h>, mapped onto the compiler's atomics
+#define smp_rmb()                   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()                   __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_store_release(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+
+#endif /*SIM_ASM_BARRIER_H_*/
@@ -0,0 +1,10 @@
+#ifndef SIM_ASM_IO_H_
+#define SIM_ASM_IO_H_
+
+// MMIO goes to the register models instead of the bus
+#include "../../sim.h"
+
+#define readl(addr)                 sim_mmio_read(addr)
+#define writel(value, addr)         sim_mmio_write(value, addr)
+
+#endif /*SIM_ASM_IO_H_*/
@@ -0,0 +1,10 @@
+#ifndef SIM_LINUX_BITOPS_H_
+#define SIM_LINUX_BITOPS_H_
+
+// Position of the most significant set bit, 1 based, 0 for 0
+static inline int fls(unsigned int x){
+
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+#endif /*SIM_LINUX_BITOPS_H_*/
@@ -0,0 +1,8 @@
+#ifndef SIM_LINUX_COMPILER_H_
+#define SIM_LINUX_COMPILER_H_
+
+// The simulator runs on one thread: a volatile access is all READ_ONCE needs
+#define READ_ONCE(x)                (*(const volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, v)            (*(volatile __typeof__(x) *) &(x) = (v))
+
+#endif /*SIM_LINUX_COMPILER_H_*/
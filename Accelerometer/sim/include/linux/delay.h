@@ -0,0 +1,10 @@
+#ifndef SIM_LINUX_DELAY_H_
+#define SIM_LINUX_DELAY_H_
+
+// Sleeping only advances the simulated clock
+#include "../../sim.h"
+
+#define usleep_range(min, max)      sim_usleep_range(min, max)
+#define udelay(us)                  sim_advance((uint64_t) (us) * 1000)
+
+#endif /*SIM_LINUX_DELAY_H_*/
@@ -0,0 +1,13 @@
+#ifndef SIM_LINUX_JIFFIES_H_
+#define SIM_LINUX_JIFFIES_H_
+
+// jiffies derived from the simulated clock, HZ as in the DE1-SoC kernel config
+#include "../../sim.h"
+
+#define HZ                          100
+#define jiffies                     ((unsigned long) (sim_time_ns / (1000000000ULL / HZ)))
+#define msecs_to_jiffies(m)         ((unsigned long) (((m) * HZ + 999) / 1000))
+#define time_after(a, b)            ((long) ((b) - (a)) < 0)
+#define time_before(a, b)           time_after(b, a)
+
+#endif /*SIM_LINUX_JIFFIES_H_*/
@@ -0,0 +1,36 @@
+#ifndef SIM_LINUX_KERNEL_H_
+#define SIM_LINUX_KERNEL_H_
+
+// Host stand-in for <linux/kernel.h>: printk goes to stdout with the virtual time
+#include <stdlib.h>
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include "../../sim.h"
+
+#define KERN_ERR    "<3>"
+#define KERN_INFO   "<6>"
+
+#define printk(...)                 sim_printk(__VA_ARGS__)
+#define printk_ratelimited(...)     sim_printk(__VA_ARGS__)
+
+#define min(a, b)                   ((a) < (b) ? (a) : (b))
+#define max(a, b)                   ((a) > (b) ? (a) : (b))
+#define clamp(v, lo, hi)            min(max(v, lo), hi)
+
+static inline unsigned long int_sqrt(unsigned long x){
+    unsigned long root = 0, bit = 1UL << (sizeof(long) * 8 - 2);
+
+    while (bit > x)
+        bit >>= 2;
+    for (; bit; bit >>= 2){
+        if (x >= root + bit){
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+    }
+    return root;
+}
+
+#endif /*SIM_LINUX_KERNEL_H_*/
@@ -0,0 +1,13 @@
+#ifndef SIM_LINUX_KTIME_H_
+#define SIM_LINUX_KTIME_H_
+
+// ktime is the simulated clock in nanoseconds
+#include "../../sim.h"
+
+typedef int64_t ktime_t;
+
+#define ktime_get()                 ((ktime_t) sim_time_ns)
+#define ktime_us_delta(later, earlier)  (((later) - (earlier)) / 1000)
+#define ktime_to_ns(kt)             (kt)
+
+#endif /*SIM_LINUX_KTIME_H_*/
@@ -0,0 +1,12 @@
+#ifndef SIM_LINUX_MATH64_H_
+#define SIM_LINUX_MATH64_H_
+
+// Host stand-in for <linux/math64.h>
+#include <linux/types.h>
+
+static inline int64_t div64_s64(int64_t dividend, int64_t divisor){
+
+    return dividend / divisor;
+}
+
+#endif /*SIM_LINUX_MATH64_H_*/
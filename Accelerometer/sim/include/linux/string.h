@@ -0,0 +1,6 @@
+#ifndef SIM_LINUX_STRING_H_
+#define SIM_LINUX_STRING_H_
+
+#include <string.h>
+
+#endif /*SIM_LINUX_STRING_H_*/
@@ -0,0 +1,18 @@
+#ifndef SIM_LINUX_TYPES_H_
+#define SIM_LINUX_TYPES_H_
+
+// Host stand-in for <linux/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#endif /*SIM_LINUX_TYPES_H_*/
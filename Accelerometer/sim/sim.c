@@ -0,0 +1,99 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "../address_map_arm.h"
+
+// Virtual clock, MMIO decode and printk for the host build of ADXL345.c
+
+extern volatile int *I2C0_ptr;
+extern volatile int *SYSMGR_ptr;
+
+uint64_t sim_time_ns;
+bool sim_verbose;
+
+static int i2c0_window[I2C0_SPAN / 4];
+uint32_t sim_sysmgr[SYSMGR_SPAN / 4];
+
+void sim_reset(void){
+    sim_time_ns = 0;
+    I2C0_ptr = i2c0_window;
+    SYSMGR_ptr = (volatile int *) sim_sysmgr;
+    for (int i = 0; i < SYSMGR_SPAN / 4; i++)
+        sim_sysmgr[i] = 0;
+    i2c0_sim_reset();
+    adxl345_sim_reset();
+}
+
+// Run both models up to sim_time_ns + ns, one event at a time so that bus
+// transfers and conversions interleave the way they would on the board
+void sim_advance(uint64_t ns){
+    uint64_t end = sim_time_ns + ns;
+    uint64_t t, a;
+
+    while (1){
+        t = i2c0_sim_next_event();
+        a = adxl345_sim_next_event();
+        if (a < t)
+            t = a;
+        if (t > end)
+            break;
+        if (t > sim_time_ns)
+            sim_time_ns = t;
+        i2c0_sim_step(sim_time_ns);
+        adxl345_sim_step(sim_time_ns);
+    }
+    sim_time_ns = end;
+}
+
+// An idle kernel programs the hrtimer for the end of the range
+void sim_usleep_range(unsigned long min, unsigned long max){
+
+    (void) min;
+    sim_advance((uint64_t) max * 1000 + SIM_WAKEUP_NS);
+}
+
+static int i2c0_reg(const volatile void *addr){
+    const volatile int *p = addr;
+
+    if (p < i2c0_window || p >= i2c0_window + I2C0_SPAN / 4){
+        fprintf(stderr, "sim: MMIO access outside I2C0 at %p\n", (void *) addr);
+        abort();
+    }
+    return p - i2c0_window;
+}
+
+uint32_t sim_mmio_read(const volatile void *addr){
+    const volatile uint32_t *p = addr;
+
+    sim_advance(SIM_MMIO_NS);
+    if (p >= sim_sysmgr && p < sim_sysmgr + SYSMGR_SPAN / 4)
+        return *p;
+    return i2c0_sim_read(i2c0_reg(addr));
+}
+
+void sim_mmio_write(uint32_t value, volatile void *addr){
+    volatile uint32_t *p = addr;
+
+    sim_advance(SIM_MMIO_NS);
+    if (p >= sim_sysmgr && p < sim_sysmgr + SYSMGR_SPAN / 4)
+        *p = value;
+    else
+        i2c0_sim_write(i2c0_reg(addr), value);
+}
+
+// Kernel messages are printed with the virtual time when sim_verbose is set
+int sim_printk(const char *fmt, ...){
+    va_list ap;
+    int n;
+
+    if (!sim_verbose)
+        return 0;
+    if (fmt[0] == '<' && fmt[2] == '>')
+        fmt += 3;
+    printf("[%10.6f] ", sim_time_ns / 1e9);
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    return n;
+}
@@ -0,0 +1,71 @@
+#ifndef ACCELEROMETER_SIM_H_
+#define ACCELEROMETER_SIM_H_
+
+/* Register level model of the HPS I2C0 controller (DesignWare) and the ADXL345
+ * for running ADXL345.c on a host. Time is virtual: MMIO accesses cost
+ * SIM_MMIO_NS, usleep_range() jumps the clock forward, and the I2C0 and ADXL345
+ * models are stepped in time order in between. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_MMIO_NS         150         // one readl/writel on the L4 bus
+#define SIM_WAKEUP_NS       10000       // scheduling latency added to every sleep
+
+extern uint64_t sim_time_ns;
+extern bool sim_verbose;
+extern uint32_t sim_sysmgr[];   // system manager words, plain memory
+
+void sim_reset(void);           // also points I2C0_ptr/SYSMGR_ptr at the models
+void sim_advance(uint64_t ns);
+void sim_usleep_range(unsigned long min, unsigned long max);
+uint32_t sim_mmio_read(const volatile void *addr);
+void sim_mmio_write(uint32_t value, volatile void *addr);
+int sim_printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// I2C0 controller (i2c0_sim.c)
+struct i2c0_sim_stats {
+    uint64_t bytes;             // bytes clocked on the bus, address bytes included
+    uint64_t busy_ns;           // time the bus was not idle
+    uint64_t transfers;         // STOPs issued
+    uint64_t aborts;            // TX_ABRT raised
+};
+
+extern struct i2c0_sim_stats i2c0_sim_stats;
+extern int i2c0_sim_nack;       // NACK this many upcoming address phases
+extern bool i2c0_sim_wedged;    // slave holds SDA low, nothing completes
+
+void i2c0_sim_reset(void);
+uint32_t i2c0_sim_read(int reg);
+void i2c0_sim_write(int reg, uint32_t value);
+uint64_t i2c0_sim_next_event(void);
+void i2c0_sim_step(uint64_t now);
+
+// ADXL345 (adxl345_sim.c), called by the I2C0 model for each bus event
+#define ADXL345_SIM_ADDR    0x53
+
+struct adxl345_sim_stats {
+    uint64_t samples;           // conversions made while measuring
+    uint64_t dropped;           // samples lost to a full FIFO
+    uint64_t popped;            // FIFO entries read out
+    uint64_t first_ns;          // time of the first of those conversions
+};
+
+extern struct adxl345_sim_stats adxl345_sim_stats;
+extern int adxl345_sim_mg[3];   // acceleration applied to the part
+extern int adxl345_sim_shake_mg;    // +- this much on X, alternating every conversion
+extern bool adxl345_sim_ramp;   // X counts conversions instead (for gap checks)
+extern int adxl345_sim_odr_ppm; // conversion period error in ppm, positive runs slow
+extern int adxl345_sim_selftest_mg[3];  // force SELF_TEST adds
+
+void adxl345_sim_reset(void);
+uint8_t adxl345_sim_reg(int reg);
+bool adxl345_sim_start(int addr, bool read);
+bool adxl345_sim_write_byte(uint8_t value);
+uint8_t adxl345_sim_read_byte(void);
+void adxl345_sim_stop(void);
+void adxl345_sim_tap(bool double_tap);
+uint64_t adxl345_sim_next_event(void);
+void adxl345_sim_step(uint64_t now);
+
+#endif /*ACCELEROMETER_SIM_H_*/
@@ -5,11 +5,27 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/moduleparam.h>
+#include <linux/math64.h>
+#include <linux/bcd.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
 
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include "address_map_arm.h"
 #include "interrupt_ID.h"
+#include "stopwatch.h"
+
+#define CREATE_TRACE_POINTS
+#include "stopwatch_trace.h"
 
 
 //The functions for the character device driver
@@ -17,17 +33,160 @@ static int stopwatch_open (struct inode *, struct file *);
 static int stopwatch_release (struct inode *, struct file *);
 static ssize_t stopwatch_read (struct file *, char *, size_t, loff_t *);
 static ssize_t stopwatch_write (struct file *, const char *, size_t, loff_t *);
+static unsigned int stopwatch_poll (struct file *, poll_table *);
+static long stopwatch_ioctl (struct file *, unsigned int, unsigned long);
+static int laps_open (struct inode *, struct file *);
+static int laps_release (struct inode *, struct file *);
+static ssize_t laps_read (struct file *, char *, size_t, loff_t *);
+static ssize_t laps_write (struct file *, const char *, size_t, loff_t *);
 
-//Global variables to track time, stopwatch initializes at 59:59:99
+//Time every stopwatch initializes at, 59:59:99
 int min = 59; int sec = 59; int ms = 99;
-int time;
 
-//Is set when "disp" is written to device driver
-bool disp = false;
+//Number of stopwatches, each its own minor. The first is /dev/stopwatch and
+//the others /dev/stopwatch1 and up
+#define MAX_INSTANCES 16
+static int instances = 1;
+module_param(instances, int, 0444);
+
+//A stopwatch counts down from the time it was last set, started or stopped at
+//(its anchor), so all of them run from the one cycle count and nothing is done
+//per stopwatch on a tick. Times are kept in timer cycles, whatever resolution
+//they are shown in. Protected by timer_lock
+struct stopwatch {
+    int index;                  // minor number, counted from the first
+    bool running;               // cleared by "stop"
+    u64 anchor_cycles;          // cycle count when the time was last brought up to date
+    u64 anchor_left;            // cycles left at anchor_cycles
+    u64 deadline;               // cycle count of the next event, the alarm or zero
+    int heap_pos;               // place in deadlines, -1 when not counting down
+    u64 alarm;                  // "alarm" threshold in cycles left, 0 for none
+    u32 events;                 // alarms and expiries so far
+    wait_queue_head_t wait;     // woken on each of them
+};
+
+//State of one open stopwatch file. After "wait" is written to it, a read
+//blocks until an alarm or expiry happened since the file's last read, and
+//poll reports the file readable once one has
+struct stopwatch_file {
+    struct stopwatch *sw;
+    u32 events;                 // sw->events when this file last read
+    bool wait;
+    char msg[24];               // the time as last read
+};
+
+static struct stopwatch stopwatches[MAX_INSTANCES];
+
+//Stopwatches counting down, as a min-heap on deadline so the next one to
+//expire is always deadlines[0]
+static struct stopwatch *deadlines[MAX_INSTANCES];
+static int deadline_count;
+
+//The stopwatch "disp" was last written to, NULL when the display is off. The
+//time shown is kept in packed BCD 0xMMSSCC, one digit per nibble, so counting
+//it down on a tick and showing it never divides
+static struct stopwatch *disp_sw = NULL;
+static u32 disp_time;
+static u64 disp_due;            // cycle count at which disp_time next changes
 
 //Pointer for LW Bridge, timer and hex
 void * LW_virtual;
-volatile int *timer_ptr, *HEX_3_0_ptr, *HEX_4_5_ptr;
+volatile int *timer_ptr, *timer1_ptr, *HEX_3_0_ptr, *HEX_4_5_ptr, *KEY_ptr;
+
+//Interval timer registers (16-bit, one per word) and their bits
+#define TIMER_STATUS    0
+#define TIMER_CONTROL   1
+#define TIMER_PERIODL   2
+#define TIMER_PERIODH   3
+#define TIMER_SNAPL     4
+#define TIMER_SNAPH     5
+#define TIMER_TO        0x1     // status: counter reached zero
+#define TIMER_ITO       0x1     // control: interrupt on timeout
+#define TIMER_CONT      0x2
+#define TIMER_START     0x4
+#define TIMER_STOP      0x8
+
+//The timers count down at 100 MHz. The display steps in hundredths of a
+//second, and by default TIMER0 interrupts every hundredth (a tick)
+#define TICK_CYCLES     1000000
+#define MAX_PERIOD      0x7FFFFFFF  // longest period programmed, half the counter wrap
+#define MIN_PERIOD      1000        // shortest period programmed in tickless mode
+
+//Time between interrupts outside tickless mode, "period N" sets it in
+//microseconds. Only a period of a hundredth counts the display down without
+//dividing
+static int period_us = 10000;
+module_param(period_us, int, 0444);
+static u32 tick_cycles;
+
+//Resolution times are read back in, "resolution N" sets it in microseconds, a
+//power of ten up to a hundredth. res_digits is the digits after the seconds
+static int resolution_us = 10000;
+module_param(resolution_us, int, 0444);
+static int res_digits;
+
+//Count time on TIMER1 left running freely instead of on TIMER0. TIMER0 is then
+//only there for the interrupts, and reloading it loses no time. TIMER1 has no
+//interrupt, its wraps are caught by reading it at least every MAX_PERIOD
+static bool timer1 = false;
+module_param(timer1, bool, 0444);
+static u64 timer1_base;         // cycles in the TIMER1 wraps seen
+static u32 timer1_last;         // TIMER1 counter when last read
+static u64 timer1_period_end;   // TIMER1 cycles at the end of TIMER0's current period
+
+//Tickless mode: instead of an interrupt every tick, TIMER0 is only programmed to
+//interrupt for the next display refresh, the next countdown reaching zero or
+//the counter wrapping
+static bool tickless = false;
+module_param(tickless, bool, 0444);
+
+//Protects the cycle count below, the timer registers and the stopwatches.
+//Everything that changes them takes it as a writer, the IRQ included, so a
+//write command is atomic with respect to a tick. Reading a stopwatch takes
+//nothing and retries if a writer got in meanwhile
+static DEFINE_SEQLOCK(timer_lock);
+static u64 timer_base;          // cycles counted before the current period
+static u32 timer_period;        // cycles in the current period
+
+//How late the timer interrupt runs, read off the counter itself as the cycles
+//since it reloaded, and how many periods ended without an interrupt of their
+//own, counted on TIMER1 when it runs and else found from the time between two
+//interrupts. Shown in debugfs as
+//stopwatch/irq_latency, writing to it starts over. Protected by timer_lock
+#define LAT_BUCKETS 16      // below 1 us, then up to 2, 4, ... us, the last one longer
+static struct {
+    u64 count;
+    u64 sum;                // latency in cycles
+    u32 min, max;
+    u32 hist[LAT_BUCKETS];
+    u64 missed;
+    u64 last_ns;            // ktime of the last interrupt
+    u32 last_latency;
+    bool last_valid;        // the period has not been reloaded since
+} irq_stats;
+
+static struct dentry *stopwatch_debugfs;
+
+//Laps taken with the "lap" command or KEY0. Each is recorded with the cycle
+//count, so a split is resolved to 10 ns, and kept until read from the laps
+//device. When full the oldest laps are overwritten, gaps in seq show how many
+//were lost. struct stopwatch_lap is in stopwatch.h. Protected by timer_lock
+#define LAP_COUNT STOPWATCH_LAPS    // power of two
+static struct stopwatch_lap laps[LAP_COUNT];
+static u32 lap_head, lap_tail;
+
+//Timeline of starts, stops, sets, laps, alarms and expiries, for lining the
+//stopwatches up with ftrace and perf captures, read from debugfs as
+//stopwatch/events. Entries are logged with timer_lock held, readers copy
+//them in a read section of it like sw_time(), so one rewritten while it was
+//read is copied again rather than torn
+#define EVENT_COUNT STOPWATCH_EVENTS    // power of two
+static struct stopwatch_event ev_log[EVENT_COUNT];
+static u32 ev_head;
+
+//KEY0 takes a lap on the first stopwatch when set at load time
+static bool lap_key = false;
+module_param(lap_key, bool, 0444);
 
 //define name of character device driver
 #define SUCCESS 0
@@ -38,100 +197,549 @@ static dev_t stopwatch_no = 0;
 static struct cdev *stopwatch_cdev = NULL;
 static struct class *stopwatch_class = NULL;
 
-// Assume that no message longer than this will be used
-#define MAX_SIZE 256
-
-//The character array that can be read
-static char stopwatch_msg[MAX_SIZE];
+//The laps device
+#define LAPS_NAME "stopwatch_laps"
+static dev_t laps_no = 0;
+static struct cdev *laps_cdev = NULL;
 
-//The character array that can be written to
-static char stopwatch_msg2[MAX_SIZE];
+// Assume that no message longer than this will be used
+#define MAX_SIZE 64
 
 //File Operations structure to open, release and read device-driver
 static struct file_operations fops = {
 	.owner = THIS_MODULE,
 	.read = stopwatch_read,
 	.write = stopwatch_write,
+	.poll = stopwatch_poll,
+	.unlocked_ioctl = stopwatch_ioctl,
 	.open = stopwatch_open,
-	.release = stopwatch_release
+	.release = stopwatch_release,
+	.llseek = default_llseek
 };
 
-//Function to convert numeric value into output for 7 segment display
-int hex(int num){
-	switch(num){
-		case 0:
-			return 0x3F;
-		case 1:
-			return 0x06;
-		case 2:
-			return 0x5B;
-		case 3:
-			return 0x4F;
-		case 4:
-			return 0x66;
-		case 5:
-			return 0x6D;
-		case 6:
-			return 0x7D;
-		case 7:
-			return 0x07;
-		case 8:
-			return 0x7F;
-		case 9:
-			return 0x67;
-	}
+//File Operations structure for the laps device
+static struct file_operations laps_fops = {
+	.owner = THIS_MODULE,
+	.read = laps_read,
+	.write = laps_write,
+	.open = laps_open,
+	.release = laps_release
+};
+
+//Seven segment patterns for a digit, A to F included so any nibble is safe
+static const u8 seg7[16] = {
+	0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07,
+	0x7F, 0x67, 0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71
+};
+
+//Patterns for both digits of a BCD byte, filled in from seg7 at load time
+static u16 seg_pair[256];
+
+static void seg_pair_init(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		seg_pair[i] = seg7[i & 0xF] | (seg7[i >> 4] << 8);
 }
 
-//Interrupt handler for the timer, interrupt is generated every millisecond
-irq_handler_t irq_handler(int irq, void *dev_id, struct pt_regs *regs)
+//Count a packed BCD time down by one hundredth. A digit at zero borrows from
+//the next and reloads with its largest value, 5 for the tens of seconds
+static const u8 bcd_reload[6] = {9, 9, 9, 5, 9, 9};
+
+static u32 bcd_dec(u32 t)
 {
+    int i;
 
-    //Clear interrupt
-    *(timer_ptr) = 0;
+    for (i = 0; i < 24; i += 4) {
+        if ((t >> i) & 0xF)
+            return t - (1 << i);
+        t |= bcd_reload[i / 4] << i;
+    }
+    return 0;
+}
 
+//Convert hundredths of a second to a BCD time value
+static u32 cs_to_time(int cs)
+{
+    return (bin2bcd(cs / 6000) << 16) | (bin2bcd((cs / 100) % 60) << 8) | bin2bcd(cs % 100);
+}
 
-    int digit0, digit1, digit2, digit3, digit4, digit5;
-    int temp;
+//BCD time the display shows for cycles left, rounded up so it only shows zero
+//once the countdown is over
+static u32 left_to_time(u64 left)
+{
+    return cs_to_time(div_u64(left + TICK_CYCLES - 1, TICK_CYCLES));
+}
+
+//Output a BCD time value to the seven segment display
+static void display_time(u32 t)
+{
+    *(HEX_3_0_ptr) = seg_pair[t & 0xFF] | (seg_pair[(t >> 8) & 0xFF] << 16);
+    *(HEX_4_5_ptr) = seg_pair[(t >> 16) & 0xFF];
+}
+
+//Latch and read a timer counter. Readers latch without taking timer_lock, so
+//another CPU may latch again between the two halves; the halves are read
+//twice and the read repeated until both agree
+static u32 timer_snapshot(volatile int *timer)
+{
+    u32 high, low;
+
+    do {
+        *(timer + TIMER_SNAPL) = 0;
+        high = *(timer + TIMER_SNAPH) & 0xFFFF;
+        low = *(timer + TIMER_SNAPL) & 0xFFFF;
+    } while (high != (*(timer + TIMER_SNAPH) & 0xFFFF) || low != (*(timer + TIMER_SNAPL) & 0xFFFF));
+
+    return (high << 16) | low;
+}
+
+//Cycles counted by TIMER0 since it was set up. The snapshot is taken before the
+//status is read, so a timeout still pending belongs to the count only if the
+//counter had already reloaded. Called with timer_lock held, or inside a read
+//section
+static u64 timer_cycles(void)
+{
+    u32 count;
+
+    //Not programmed yet
+    if (!timer_period)
+        return timer_base;
+
+    count = timer_snapshot(timer_ptr);
+
+    if ((*(timer_ptr + TIMER_STATUS) & TIMER_TO) && count >= timer_period / 2)
+        return timer_base + timer_period + (timer_period - 1 - count);
+    return timer_base + (timer_period - 1 - count);
+}
+
+//Cycles counted by TIMER1, which counts down from 0xFFFFFFFF and wraps, without
+//recording the wrap. Called inside a read section
+static u64 timer1_peek(u32 *count)
+{
+    *count = timer_snapshot(timer1_ptr);
+    return timer1_base + (*count > timer1_last ? 1ULL << 32 : 0) + (0xFFFFFFFF - *count);
+}
 
-    if (time > 0) {time--;}
+//Cycles counted by TIMER1. Called with timer_lock held
+static u64 timer1_cycles(void)
+{
+    u32 count;
+    u64 cycles = timer1_peek(&count);
+
+    timer1_base = cycles - (0xFFFFFFFF - count);
+    timer1_last = count;
+    return cycles;
+}
+
+//The cycle count the stopwatches run from. Called with timer_lock held
+static u64 clock_now(void)
+{
+    return timer1 ? timer1_cycles() : timer_cycles();
+}
 
-    //Get seconds and miliseconds
-    temp = time % 10000;
+//The same for readers, inside a read section
+static u64 clock_peek(void)
+{
+    u32 count;
 
-    //Wrap around to next minute
-    if  (temp == 9999) { time = time  - 9999 + 5999;}
+    return timer1 ? timer1_peek(&count) : timer_cycles();
+}
 
- //   set_time_display();
-    digit0 = time %10; 		            //milliseconds first digit
-    digit1 = (time %100)/10;		    //milliseconds second digit
-    digit2 = (time %1000)/100;	        //seconds first digit
-    digit3 = (time %10000)/1000;	    //seconds second digit
-    digit4 = (time %100000)/10000;	    //minutes first digit
-    digit5 = (time %1000000)/100000;	//minutes second digit
+//Load a new period into TIMER0, loading the period stops the counter so its
+//count is folded into timer_base first. Called with timer_lock held
+static void timer_program(u32 cycles)
+{
+    *(timer_ptr + TIMER_CONTROL) = TIMER_STOP;
+    timer_base = timer_cycles();
 
-    //Assemble in minutes, seconds and milliseconds
-    ms =  digit0 + (digit1*10);
-    sec = digit2 + (digit3*10);
-    min = digit4 + (digit5*10);
+    *(timer_ptr + TIMER_PERIODL) = (cycles - 1) & 0xFFFF;
+    *(timer_ptr + TIMER_PERIODH) = (cycles - 1) >> 16;
+    *(timer_ptr + TIMER_STATUS) = 0;
+    timer_period = cycles;
 
-    //If Boolean disp is true output the stopwatch value to seven segment display
-    if (disp){
-        *(HEX_3_0_ptr) = hex(digit0)| (hex(digit1)<<8) | (hex(digit2) << 16) | (hex(digit3) << 24);
-        *(HEX_4_5_ptr) = hex(digit4) | (hex(digit5) <<8);
+    *(timer_ptr + TIMER_CONTROL) = TIMER_START | TIMER_CONT | TIMER_ITO;
+    if (timer1)
+        timer1_period_end = timer1_cycles() + cycles;
+    irq_stats.last_valid = false;
+}
+
+//Account for a timer interrupt taken at ktime ns, latency cycles after the
+//period ended. TIMER0 reloads without a trace, so without TIMER1 the periods
+//that went by unseen before this one can only be told from ktime, and the
+//estimate is returned. Called with timer_lock held
+static u32 irq_account(u64 ns, u32 latency)
+{
+    u64 span, period_ns = (u64) timer_period * 10;
+    u32 missed = 0;
+    int bucket;
+
+    //Time between the ends of the two periods, more than one period means
+    //the timeout bit was set again before the last one was handled
+    if (irq_stats.last_valid) {
+        span = ns - irq_stats.last_ns + (u64) irq_stats.last_latency * 10 - (u64) latency * 10;
+        if (span > period_ns + period_ns / 2)
+            missed = div64_u64(span + period_ns / 2, period_ns) - 1;
     }
+    irq_stats.last_ns = ns;
+    irq_stats.last_latency = latency;
+    irq_stats.last_valid = true;
 
-    //Copy current time value onto output variable
-    sprintf(stopwatch_msg, "%02d:%02d:%02d",min,sec,ms);
+    if (!irq_stats.count || latency < irq_stats.min)
+        irq_stats.min = latency;
+    if (latency > irq_stats.max)
+        irq_stats.max = latency;
+    irq_stats.sum += latency;
+    irq_stats.count++;
+    bucket = fls(latency / 100);
+    irq_stats.hist[bucket < LAT_BUCKETS ? bucket : LAT_BUCKETS - 1]++;
 
+    return missed;
+}
 
-   return (irq_handler_t) IRQ_HANDLED;
+//The periods that went by unseen before the one an interrupt handles, exactly,
+//from TIMER1 cycles at now: TIMER1 counts the same 100 MHz clock as TIMER0, so
+//every period ends a whole number of timer_period after timer1_period_end.
+//Divides only when a period was missed. Called with timer_lock held
+static u32 irq_missed(u64 now)
+{
+    u32 missed = 0;
+
+    if (now > timer1_period_end && now - timer1_period_end >= timer_period)
+        missed = div_u64(now - timer1_period_end, timer_period);
+    timer1_period_end += (u64) timer_period * (1 + missed);
+    return missed;
+}
+
+//Min-heap of deadlines, called with timer_lock held
+static void heap_swap(int a, int b)
+{
+    struct stopwatch *sw = deadlines[a];
+
+    deadlines[a] = deadlines[b];
+    deadlines[b] = sw;
+    deadlines[a]->heap_pos = a;
+    deadlines[b]->heap_pos = b;
+}
+
+static void heap_up(int i)
+{
+    while (i > 0 && deadlines[(i - 1) / 2]->deadline > deadlines[i]->deadline) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i)
+{
+    int child;
+
+    while ((child = 2 * i + 1) < deadline_count) {
+        if (child + 1 < deadline_count && deadlines[child + 1]->deadline < deadlines[child]->deadline)
+            child++;
+        if (deadlines[i]->deadline <= deadlines[child]->deadline)
+            break;
+        heap_swap(i, child);
+        i = child;
+    }
+}
+
+static void heap_add(struct stopwatch *sw)
+{
+    sw->heap_pos = deadline_count++;
+    deadlines[sw->heap_pos] = sw;
+    heap_up(sw->heap_pos);
+}
+
+static void heap_del(struct stopwatch *sw)
+{
+    int i = sw->heap_pos;
+
+    if (i < 0)
+        return;
+    sw->heap_pos = -1;
+    if (i != --deadline_count) {
+        deadlines[i] = deadlines[deadline_count];
+        deadlines[i]->heap_pos = i;
+        heap_down(i);
+        heap_up(i);
+    }
+}
+
+//Cycles left on a stopwatch at cycle count now
+static u64 sw_left(struct stopwatch *sw, u64 now)
+{
+    u64 gone = now - sw->anchor_cycles;
+
+    if (!sw->running)
+        return sw->anchor_left;
+    return gone >= sw->anchor_left ? 0 : sw->anchor_left - gone;
+}
+
+//Cycles from now to the next hundredth on the stopwatch shown, MAX_PERIOD
+//when the display is off or not counting
+static u32 disp_next(u64 now)
+{
+    u32 into;
+
+    if (!disp_sw || disp_sw->heap_pos < 0)
+        return MAX_PERIOD;
+    div_u64_rem(sw_left(disp_sw, now), TICK_CYCLES, &into);
+    return into ? into : TICK_CYCLES;
+}
+
+//Cycles from now to the next interrupt tickless mode needs: the next hundredth
+//while the display is on, the next countdown reaching zero, or else a wrap
+static u32 tickless_period(u64 now)
+{
+    u64 left = !disp_sw || disp_sw->heap_pos < 0 ? MAX_PERIOD : disp_due > now ? disp_due - now : 0;
+
+    if (deadline_count && deadlines[0]->deadline <= now)
+        left = 0;
+    else if (deadline_count && deadlines[0]->deadline - now < left)
+        left = deadlines[0]->deadline - now;
+    return left < MIN_PERIOD ? MIN_PERIOD : left;
+}
+
+//Program the next interrupt after the schedule changed. With ticks the period
+//is restarted so the first tick falls on a hundredth of the stopwatch shown.
+//Called with timer_lock held
+static void timer_reschedule(u64 now)
+{
+    u32 next = disp_next(now);
+
+    if (tickless)
+        timer_program(tickless_period(now));
+    else
+        timer_program(next < tick_cycles ? next : tick_cycles);
+}
+
+//Show a stopwatch from now on
+static void disp_set(struct stopwatch *sw, u64 now)
+{
+    disp_time = left_to_time(sw_left(sw, now));
+    disp_due = now + disp_next(now);
+    display_time(disp_time);
+}
+
+//Put a counting stopwatch in the heap for its next event, the alarm while it
+//is still ahead or else zero. Called with timer_lock held
+static void sw_schedule(struct stopwatch *sw, u64 now)
+{
+    u64 target = 0;
+
+    heap_del(sw);
+    if (!sw->running || sw->anchor_left == 0)
+        return;
+    if (sw->alarm && sw->alarm < sw_left(sw, now))
+        target = sw->alarm;
+    sw->deadline = sw->anchor_cycles + sw->anchor_left - target;
+    heap_add(sw);
+}
+
+//Restart a stopwatch with cycles left at cycle count now. Called with
+//timer_lock held
+static void sw_anchor(struct stopwatch *sw, u64 left, u64 now)
+{
+    sw->anchor_left = left;
+    sw->anchor_cycles = now;
+    sw_schedule(sw, now);
+
+    if (sw == disp_sw)
+        disp_set(sw, now);
+    if (tickless || sw == disp_sw)
+        timer_reschedule(now);
+}
+
+//Log an event on a stopwatch at cycle count now and fire its tracepoint. now
+//can be in the past, the IRQ passes the end of the period it handles, so the
+//CLOCK_MONOTONIC time is taken together with the current count and dated back
+//by the difference, 10 ns a cycle. Called with timer_lock held
+static void event_log(struct stopwatch *sw, int type, u64 now)
+{
+    struct stopwatch_event *e = &ev_log[ev_head & (EVENT_COUNT - 1)];
+    u64 cycles = clock_now(), ns = ktime_get_ns();
+
+    e->seq = ev_head++;
+    e->cycles = now;
+    e->ns = cycles >= now ? ns - (cycles - now) * 10 : ns + (now - cycles) * 10;
+    e->left = sw_left(sw, now);
+    e->type = type;
+    e->instance = sw->index;
+
+    switch (type) {
+    case STOPWATCH_EV_START: trace_stopwatch_start(e); break;
+    case STOPWATCH_EV_STOP: trace_stopwatch_stop(e); break;
+    case STOPWATCH_EV_SET: trace_stopwatch_set(e); break;
+    case STOPWATCH_EV_LAP: trace_stopwatch_lap(e); break;
+    case STOPWATCH_EV_ALARM: trace_stopwatch_alarm(e); break;
+    case STOPWATCH_EV_EXPIRE: trace_stopwatch_expire(e); break;
+    }
+}
+
+//A stopwatch passed its alarm or reached zero by cycle count now, wake up
+//whoever waits on it. The event is logged at its deadline, not at now, which
+//is the end of the period the IRQ handles. Called with timer_lock held
+static void sw_event(struct stopwatch *sw, u64 now)
+{
+    u64 end = sw->anchor_cycles + sw->anchor_left;
+
+    heap_del(sw);
+    sw->events++;
+    wake_up_interruptible(&sw->wait);
+
+    if (sw->deadline < end) {
+        event_log(sw, STOPWATCH_EV_ALARM, sw->deadline);
+        sw_schedule(sw, now);
+        return;
+    }
+
+    sw->anchor_left = 0;
+    sw->anchor_cycles = end;
+    event_log(sw, STOPWATCH_EV_EXPIRE, end);
+    if (sw == disp_sw && disp_time) {
+        disp_time = 0;
+        display_time(disp_time);
+    }
+}
+
+//Cycles left on a stopwatch now, and the resolution to show them in as
+//format_left() takes it, without blocking writers or the IRQ
+static u64 sw_time(struct stopwatch *sw, int *res_us, int *digits)
+{
+    unsigned seq;
+    u64 t;
+
+    do {
+        seq = read_seqbegin(&timer_lock);
+        t = sw_left(sw, clock_peek());
+        *res_us = resolution_us;
+        *digits = res_digits;
+    } while (read_seqretry(&timer_lock, seq));
+    return t;
+}
+
+//The resolution alone, for times taken earlier
+static void res_get(int *res_us, int *digits)
+{
+    unsigned seq;
+
+    do {
+        seq = read_seqbegin(&timer_lock);
+        *res_us = resolution_us;
+        *digits = res_digits;
+    } while (read_seqretry(&timer_lock, seq));
+}
+
+//Record a lap at the current count. Called with timer_lock held
+static void lap_record(struct stopwatch *sw)
+{
+    struct stopwatch_lap *l = &laps[lap_head & (LAP_COUNT - 1)];
+
+    l->cycles = clock_now();
+    l->left = sw_left(sw, l->cycles);
+    l->seq = lap_head++;
+    l->instance = sw->index;
+    if (lap_head - lap_tail > LAP_COUNT)
+        lap_tail = lap_head - LAP_COUNT;
+    event_log(sw, STOPWATCH_EV_LAP, l->cycles);
+}
+
+//Interrupt handler for the pushbuttons, KEY0 takes a lap
+irq_handler_t key_handler(int irq, void *dev_id, struct pt_regs *regs)
+{
+    int edges = *(KEY_ptr + 3);
+
+    //Clear the edge capture bits
+    *(KEY_ptr + 3) = edges;
+
+    if (edges & 0x1) {
+        write_seqlock(&timer_lock);
+        lap_record(&stopwatches[0]);
+        write_sequnlock(&timer_lock);
+    }
+    return (irq_handler_t) IRQ_HANDLED;
+}
+
+//Interrupt handler for the timer, interrupt is generated every hundredth of a
+//second, or in tickless mode only when a refresh or a countdown is due. The
+//work on a tick does not depend on the number of stopwatches, only the ones
+//expiring are touched
+irq_handler_t irq_handler(int irq, void *dev_id, struct pt_regs *regs)
+{
+    u64 now, ns = ktime_get_ns();
+    u32 period, count, missed;
+
+    write_seqlock(&timer_lock);
+
+    //A reload since the timeout already counted it and cleared it
+    if (!(*(timer_ptr + TIMER_STATUS) & TIMER_TO)) {
+        write_sequnlock(&timer_lock);
+        return (irq_handler_t) IRQ_NONE;
+    }
+
+    //The counter has been running down since the period ended
+    count = timer_snapshot(timer_ptr);
+
+    //Clear interrupt, the period just ended, and any that went by unseen, are
+    //the current count. TIMER1 counts the unseen ones, without it there is
+    //only the estimate from ktime
+    *(timer_ptr) = 0;
+    missed = irq_account(ns, timer_period - 1 - count);
+    if (timer1) {
+        now = timer1_cycles();
+        missed = irq_missed(now);
+    }
+    irq_stats.missed += missed;
+    timer_base += (u64) timer_period * (1 + missed);
+    if (!timer1)
+        now = timer_base;
+
+    if (!tickless) {
+        //Count the stopwatch shown down, a hundredth on each tick when that
+        //is the period and none went by unseen
+        if (disp_sw && disp_sw->running && disp_time) {
+            disp_time = tick_cycles == TICK_CYCLES && !missed ? bcd_dec(disp_time) : left_to_time(sw_left(disp_sw, now));
+            display_time(disp_time);
+        }
+        //Back to whole ticks after lining them up with the display
+        if (timer_period != tick_cycles)
+            timer_program(tick_cycles);
+    }
+
+    while (deadline_count && deadlines[0]->deadline <= now)
+        sw_event(deadlines[0], now);
+
+    if (tickless) {
+        //Refresh the stopwatch shown once its hundredth is over. When this is
+        //the interrupt for it, a hundredth or less late, count the BCD time
+        //down; only after missed interrupts is it converted again
+        if (disp_sw && now >= disp_due) {
+            if (disp_time && disp_sw->heap_pos >= 0 && now - disp_due < TICK_CYCLES) {
+                disp_time = bcd_dec(disp_time);
+                disp_due += TICK_CYCLES;
+                display_time(disp_time);
+            } else
+                disp_set(disp_sw, now);
+        }
+
+        //Only reload the period when it changes, each reload costs a few cycles
+        period = tickless_period(now);
+        if (period != timer_period)
+            timer_program(period);
+    }
+
+    write_sequnlock(&timer_lock);
+    return (irq_handler_t) IRQ_HANDLED;
 }
 
 
 //Initialize the timmer, hex display and interrupt handler for timer
 static int initialize_hextimer_handler(void)
 {
-    int value;
+    int value, i;
+    unsigned long flags;
 
     //Generate a virtual address for the FPGA lightweight bridge
     LW_virtual = ioremap_nocache (LW_BRIDGE_BASE, LW_BRIDGE_SPAN);
@@ -142,130 +750,655 @@ static int initialize_hextimer_handler(void)
     //Initialize hex pointers
     HEX_3_0_ptr = LW_virtual + HEX3_HEX0_BASE;
     HEX_4_5_ptr = LW_virtual + HEX5_HEX4_BASE;
+    seg_pair_init();
 
-    //Set value of counter low 16-bits
-    *(timer_ptr + 2) = 0x4240;
-    //Set value of counter high 16 bits
-    *(timer_ptr + 3) =0xF;
-    //Set START, CONT and ITO bits as high
-    *(timer_ptr + 1) = 0x7;
+    //Let TIMER1 run freely through its whole range, no interrupt
+    timer1_ptr = LW_virtual + TIMER1_BASE;
+    if (timer1) {
+        *(timer1_ptr + TIMER_PERIODL) = 0xFFFF;
+        *(timer1_ptr + TIMER_PERIODH) = 0xFFFF;
+        timer1_last = 0xFFFFFFFF;
+        *(timer1_ptr + TIMER_CONTROL) = TIMER_START | TIMER_CONT;
+    }
+
+    //Load the period for a tick, or the first event in tickless mode, and
+    //set START, CONT and ITO bits as high, then start every stopwatch
+    write_seqlock_irqsave(&timer_lock, flags);
+    timer_program(tickless ? MAX_PERIOD : tick_cycles);
+    for (i = 0; i < instances; i++) {
+        stopwatches[i].index = i;
+        stopwatches[i].running = true;
+        stopwatches[i].heap_pos = -1;
+        init_waitqueue_head(&stopwatches[i].wait);
+        sw_anchor(&stopwatches[i], (u64) (min * 6000 + sec * 100 + ms) * TICK_CYCLES, clock_now());
+    }
+    write_sequnlock_irqrestore(&timer_lock, flags);
 
     //Register the interrupt handler.
     value = request_irq (INTERVAL_TIMER_IRQi, (irq_handler_t) irq_handler, IRQF_SHARED,"irq_handler", (void *) (irq_handler));
+    if (value < 0)
+        goto err_timer;
+    if (!lap_key)
+        return 0;
+
+    //Interrupt on KEY0 presses for laps
+    KEY_ptr = LW_virtual + KEY_BASE;
+    *(KEY_ptr + 3) = 0xF;
+    *(KEY_ptr + 2) = 0x1;
+    value = request_irq (KEYS_IRQ, (irq_handler_t) key_handler, IRQF_SHARED, "key_handler", (void *) (key_handler));
+    if (value < 0) {
+        *(KEY_ptr + 2) = 0;
+        free_irq (INTERVAL_TIMER_IRQi, (void*) irq_handler);
+        goto err_timer;
+    }
+    return 0;
 
+err_timer:
+    *(timer_ptr + TIMER_CONTROL) = TIMER_STOP;
+    if (timer1)
+        *(timer1_ptr + TIMER_CONTROL) = TIMER_STOP;
+    iounmap(LW_virtual);
     return value;
+}
+
+//Undo initialize_hextimer_handler(): free the interrupts, stop the timers and
+//turn off the display
+static void release_hextimer_handler(void)
+{
+    if (lap_key) {
+        *(KEY_ptr + 2) = 0;
+        free_irq (KEYS_IRQ, (void*) key_handler);
+    }
+    free_irq (INTERVAL_TIMER_IRQi, (void*) irq_handler);
+    *(timer_ptr + TIMER_CONTROL) = TIMER_STOP;
+    if (timer1)
+        *(timer1_ptr + TIMER_CONTROL) = TIMER_STOP;
+    *HEX_3_0_ptr = 0; *HEX_4_5_ptr = 0;
+    iounmap(LW_virtual);
+}
+
+//Set the time between ticks, from 100 us to a second
+static int set_period(int us)
+{
+    if (us < 100 || us > 1000000)
+        return -EINVAL;
+    period_us = us;
+    tick_cycles = us * 100;
+    return 0;
+}
+
+//Set the resolution times are read back in
+static int set_resolution(int us)
+{
+    int digits = 2, n;
+
+    for (n = 10000; n > us; n /= 10)
+        digits++;
+    if (n != us || us < 1)
+        return -EINVAL;
+    resolution_us = us;
+    res_digits = digits;
+    return 0;
+}
+
+//Format cycles left as MM:SS:F at a resolution of res_us, F being the fraction
+//of a second in its digits, rounded up as the display is. Both come from one
+//read section, see sw_time()
+static int format_left(char *buf, u64 left, int res_us, int digits)
+{
+    u32 res = res_us * 100;
+    u32 frac, secs;
 
+    secs = div_u64_rem(div_u64(left + res - 1, res), 1000000 / res_us, &frac);
+    return sprintf(buf, "%02u:%02u:%0*u", secs / 60, secs % 60, digits, frac);
 }
 
+//Parse MM:SS:F into cycles. F of one or two digits is hundredths, as it
+//always was, with more it is the fraction of a second in as many digits as
+//the resolution has. Digits and colons only: sscanf alone would take signs,
+//spaces and anything after F. Called with timer_lock held
+static int parse_time(const char *buf, u64 *cycles)
+{
+    int mm, ss, start, end;
+    u32 frac;
+
+    if (strspn(buf, "0123456789:") != strlen(buf))
+        return -EINVAL;
+    if (sscanf(buf, "%d:%d:%n%u%n", &mm, &ss, &start, &frac, &end) != 3 || buf[end] != '\0')
+        return -EINVAL;
+    if (mm > 99 || ss > 59 || end - start > (res_digits > 2 ? res_digits : 2))
+        return -EINVAL;
+
+    if (end - start <= 2) {
+        if (frac > 99)
+            return -EINVAL;
+        *cycles = (u64) frac * TICK_CYCLES;
+    } else {
+        for (; end - start < 6; start--)
+            frac *= 10;
+        *cycles = (u64) frac * 100;
+    }
+    *cycles += (u64) (mm * 60 + ss) * STOPWATCH_HZ;
+    return *cycles > STOPWATCH_MAX_LEFT ? -EINVAL : 0;
+}
+
+//Show the interrupt statistics, times in ns
+static int irq_stats_show(struct seq_file *m, void *v)
+{
+	unsigned seq;
+	u32 hist[LAT_BUCKETS];
+	u64 count, sum, missed;
+	u32 min, max;
+	int i;
+
+	do {
+		seq = read_seqbegin(&timer_lock);
+		count = irq_stats.count; sum = irq_stats.sum; missed = irq_stats.missed;
+		min = irq_stats.min; max = irq_stats.max;
+		memcpy(hist, irq_stats.hist, sizeof (hist));
+	} while (read_seqretry(&timer_lock, seq));
+
+	seq_printf(m, "interrupts %llu\nmissed %llu\n", count, missed);
+	seq_printf(m, "min %llu\nmax %llu\nmean %llu\n", (u64) min * 10, (u64) max * 10,
+	           count ? div64_u64(sum * 10, count) : 0);
+	for (i = 0; i < LAT_BUCKETS - 1; i++)
+		seq_printf(m, "<%uus %u\n", 1 << i, hist[i]);
+	seq_printf(m, ">=%uus %u\n", 1 << (LAT_BUCKETS - 2), hist[LAT_BUCKETS - 1]);
+	return 0;
+}
+
+static int irq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, irq_stats_show, NULL);
+}
+
+//Any write starts the statistics over
+static ssize_t irq_stats_write(struct file *file, const char *buffer, size_t length, loff_t *offset)
+{
+	unsigned long flags;
+
+	write_seqlock_irqsave(&timer_lock, flags);
+	memset(&irq_stats, 0, sizeof (irq_stats));
+	write_sequnlock_irqrestore(&timer_lock, flags);
+	return length;
+}
+
+static const struct file_operations irq_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = irq_stats_open,
+	.read = seq_read,
+	.write = irq_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+//Read the event log as struct stopwatch_event, as many whole ones as fit. The
+//file offset counts entries in sizeof (struct stopwatch_event) steps, one that
+//fell behind the log goes on from the oldest entry still in it
+static ssize_t events_read(struct file *filp, char __user *buffer, size_t length, loff_t *offset)
+{
+	struct stopwatch_event e;
+	u32 pos = div_u64(*offset, sizeof (e)), head;
+	unsigned int seq;
+	size_t sent = 0;
+
+	while (length - sent >= sizeof (e)) {
+		do {
+			seq = read_seqbegin(&timer_lock);
+			head = ev_head;
+			if (head - pos > EVENT_COUNT)
+				pos = head - EVENT_COUNT;
+			if (pos != head)
+				e = ev_log[pos & (EVENT_COUNT - 1)];
+		} while (read_seqretry(&timer_lock, seq));
+		if (pos == head)
+			break;
+
+		if (copy_to_user (buffer + sent, &e, sizeof (e)) != 0)
+			return -EFAULT;
+		sent += sizeof (e);
+		pos++;
+	}
+	*offset = (loff_t) pos * sizeof (e);
+	return sent;
+}
+
+static const struct file_operations events_fops = {
+	.owner = THIS_MODULE,
+	.read = events_read,
+	.llseek = default_llseek
+};
+
 //Initialize character device driver for the stopwatch
 static int __init start_stopwatch(void)
 {
 	int err = 0;
-	int value;
-    time = 10000*min + 100*sec + ms;
+	int i;
 
-	/* Get a device number. Get one minor number (0) */
-	if ((err = alloc_chrdev_region (&stopwatch_no, 0, 1, DEVICE_NAME)) < 0) {
-		printk (KERN_ERR "stopwatch: alloc_chrdev_region() failed with return value %d\n", err);
+	if (instances < 1 || instances > MAX_INSTANCES) {
+		printk (KERN_ERR "stopwatch: instances must be 1 to %d\n", MAX_INSTANCES);
+		return -EINVAL;
+	}
+	if (set_period(period_us) < 0 || set_resolution(resolution_us) < 0) {
+		printk (KERN_ERR "stopwatch: bad period_us or resolution_us\n");
+		return -EINVAL;
+	}
+
+	// The stopwatches and the timer are ready before any device node exists
+	if ((err = initialize_hextimer_handler()) < 0) {
+		printk (KERN_ERR "stopwatch: request_irq() failed with return value %d\n", err);
 		return err;
 	}
 
+	/* Get a device number. Get a minor number for each stopwatch */
+	if ((err = alloc_chrdev_region (&stopwatch_no, 0, instances, DEVICE_NAME)) < 0) {
+		printk (KERN_ERR "stopwatch: alloc_chrdev_region() failed with return value %d\n", err);
+		goto err_timer;
+	}
+
 	// Allocate and initialize the character device
 	stopwatch_cdev = cdev_alloc ();
 	stopwatch_cdev->ops = &fops;
 	stopwatch_cdev->owner = THIS_MODULE;
 
 	// Add the character device to the kernel
-	if ((err = cdev_add (stopwatch_cdev, stopwatch_no, 1)) < 0) {
+	if ((err = cdev_add (stopwatch_cdev, stopwatch_no, instances)) < 0) {
 		printk (KERN_ERR "stopwatch: cdev_add() failed with return value %d\n", err);
-		return err;
+		goto err_cdev;
 	}
 
 	stopwatch_class = class_create (THIS_MODULE, DEVICE_NAME);
 	device_create (stopwatch_class, NULL, stopwatch_no, NULL, DEVICE_NAME );
+	for (i = 1; i < instances; i++)
+		device_create (stopwatch_class, NULL, MKDEV(MAJOR(stopwatch_no), MINOR(stopwatch_no) + i), NULL, DEVICE_NAME "%d", i);
 
+	// The laps device
+	if ((err = alloc_chrdev_region (&laps_no, 0, 1, LAPS_NAME)) < 0) {
+		printk (KERN_ERR "stopwatch: alloc_chrdev_region() failed with return value %d\n", err);
+		goto err_devices;
+	}
+	laps_cdev = cdev_alloc ();
+	laps_cdev->ops = &laps_fops;
+	laps_cdev->owner = THIS_MODULE;
+	if ((err = cdev_add (laps_cdev, laps_no, 1)) < 0) {
+		printk (KERN_ERR "stopwatch: cdev_add() failed with return value %d\n", err);
+		goto err_laps;
+	}
+	device_create (stopwatch_class, NULL, laps_no, NULL, LAPS_NAME);
 
-	value = initialize_hextimer_handler();
+	// Interrupt statistics, the stopwatch works without them
+	stopwatch_debugfs = debugfs_create_dir (DEVICE_NAME, NULL);
+	debugfs_create_file ("irq_latency", 0600, stopwatch_debugfs, NULL, &irq_stats_fops);
+	debugfs_create_file ("events", 0400, stopwatch_debugfs, NULL, &events_fops);
 
 	return 0;
+
+err_laps:
+	cdev_del (laps_cdev);
+	unregister_chrdev_region (laps_no, 1);
+err_devices:
+	for (i = 0; i < instances; i++)
+		device_destroy (stopwatch_class, MKDEV(MAJOR(stopwatch_no), MINOR(stopwatch_no) + i));
+	class_destroy (stopwatch_class);
+err_cdev:
+	cdev_del (stopwatch_cdev);
+	unregister_chrdev_region (stopwatch_no, instances);
+err_timer:
+	release_hextimer_handler();
+	return err;
 }
 
 //Destroy character device driver for stopwatch when done, free interrupt handler, turn off display
 static void __exit stop_stopwatch(void)
 {
-	device_destroy (stopwatch_class, stopwatch_no);
+	int i;
+
+	debugfs_remove_recursive (stopwatch_debugfs);
+	device_destroy (stopwatch_class, laps_no);
+	cdev_del (laps_cdev);
+	unregister_chrdev_region (laps_no, 1);
+	for (i = 0; i < instances; i++)
+		device_destroy (stopwatch_class, MKDEV(MAJOR(stopwatch_no), MINOR(stopwatch_no) + i));
 	cdev_del (stopwatch_cdev);
 	class_destroy (stopwatch_class);
-	unregister_chrdev_region (stopwatch_no, 1);
-	free_irq (INTERVAL_TIMER_IRQi, (void*) irq_handler);
-	*HEX_3_0_ptr = 0; *HEX_4_5_ptr = 0;
-	iounmap(LW_virtual);
+	unregister_chrdev_region (stopwatch_no, instances);
+	release_hextimer_handler();
 }
 
-//Called when a process opens stopwatch
+//Called when a process opens stopwatch, the minor picks the stopwatch
 static int stopwatch_open(struct inode *inode, struct file *file)
 {
+	struct stopwatch_file *f;
+
+	if (!(f = kzalloc (sizeof (*f), GFP_KERNEL)))
+		return -ENOMEM;
+	f->sw = &stopwatches[iminor(inode) - MINOR(stopwatch_no)];
+	f->events = READ_ONCE(f->sw->events);
+	file->private_data = f;
+	return SUCCESS;
+}
+
+//Called when a process opens the laps device, reads start out as text
+static int laps_open(struct inode *inode, struct file *file)
+{
+	file->private_data = NULL;
 	return SUCCESS;
 }
 
 //Called when a process closes stopwatch
 static int stopwatch_release(struct inode *inode, struct file *file)
 {
+	kfree(file->private_data);
 	return SUCCESS;
 }
 
-//Called when a process reads from stopwatch
+//Called when a process closes the laps device
+static int laps_release(struct inode *inode, struct file *file)
+{
+	return SUCCESS;
+}
+
+//Called when a process reads from stopwatch. Each time is one message, read
+//from offset 0 to its end; the read that finds the end returns 0 and rewinds
+//the file, so the next read formats, or with "wait" waits for, a new one
 static ssize_t stopwatch_read(struct file *filp, char *buffer, size_t length, loff_t *offset)
 {
-	size_t bytes;
+	struct stopwatch_file *f = filp->private_data;
+	size_t bytes, len;
+	int res_us, digits;
+	u64 left;
+	int err;
+
+	//The message is only formatted when a read starts
+	if (*offset == 0) {
+		if (f->wait) {
+			if (READ_ONCE(f->sw->events) == f->events && (filp->f_flags & O_NONBLOCK))
+				return -EAGAIN;
+			if ((err = wait_event_interruptible(f->sw->wait, READ_ONCE(f->sw->events) != f->events)) < 0)
+				return err;
+		}
+		f->events = READ_ONCE(f->sw->events);
 
+		left = sw_time(f->sw, &res_us, &digits);
+		format_left(f->msg, left, res_us, digits);
+	}
+
+	len = strlen (f->msg);
+	if (*offset >= len) {
+		*offset = 0;
+		return 0;
+	}
 
-	bytes = strlen (stopwatch_msg) - (*offset);	// how many bytes not yet sent?
+	bytes = len - (*offset);	// how many bytes not yet sent?
 	bytes = bytes > length ? length : bytes;	// too much to send all at once?
 
-	if (bytes)
-		if (copy_to_user (buffer, &stopwatch_msg[*offset], bytes) != 0)
-			printk (KERN_ERR "Error: copy_to_user unsuccessful");
-	*offset = bytes;	// keep track of number of bytes sent to the user
+	if (copy_to_user (buffer, &f->msg[*offset], bytes) != 0)
+		return -EFAULT;
+	*offset += bytes;	// keep track of number of bytes sent to the user
 	return bytes;
 }
 
+//Actions shared by the write commands and ioctl, called with timer_lock held
+static void sw_stop(struct stopwatch *sw, u64 now)
+{
+    if (sw->running) {
+        u64 left = sw_left(sw, now);
+        sw->running = false;
+        sw_anchor(sw, left, now);
+        event_log(sw, STOPWATCH_EV_STOP, now);
+    }
+}
+
+static void sw_run(struct stopwatch *sw, u64 now)
+{
+    if (!sw->running) {
+        sw->running = true;
+        sw_anchor(sw, sw->anchor_left, now);
+        event_log(sw, STOPWATCH_EV_START, now);
+    }
+}
+
+static void sw_set(struct stopwatch *sw, u64 left, u64 now)
+{
+    sw_anchor(sw, left, now);
+    event_log(sw, STOPWATCH_EV_SET, now);
+}
+
+static void sw_display(struct stopwatch *sw, bool on, u64 now)
+{
+    if (on) {
+        disp_sw = sw;
+        disp_set(sw, now);
+    } else if (disp_sw == sw) {
+        disp_sw = NULL; *HEX_3_0_ptr = 0; *HEX_4_5_ptr = 0;
+    } else
+        return;
+    timer_reschedule(now);
+}
+
+static void sw_alarm(struct stopwatch *sw, u64 alarm, u64 now)
+{
+    sw->alarm = alarm;
+    sw_schedule(sw, now);
+    if (tickless) timer_reschedule(now);
+}
+
 //Called when a process writes to stopwatch
 static ssize_t stopwatch_write(struct file *filp, const char *buffer, size_t length, loff_t *offset)
 {
+	struct stopwatch_file *f = filp->private_data;
+	struct stopwatch *sw = f->sw;
 	size_t bytes; //int num;
+	unsigned long flags;
+	u64 now, left;
+	int n, err = 0;
+	char arg[16];
+	char msg[MAX_SIZE], command[MAX_SIZE];
 	bytes = length;
-    char command[bytes];
 
 	if (bytes > MAX_SIZE - 1)	// can copy all at once, or not?
 		bytes = MAX_SIZE - 1;
-	if (copy_from_user (stopwatch_msg2, buffer, bytes) != 0)
-		printk (KERN_ERR "Error: copy_from_user unsuccessful");
-
-    stopwatch_msg2[bytes] = '\0';
-    sscanf (stopwatch_msg2, "%s", command);
-
-    //Check user input and perform actions
-    if (strcmp(command, "stop") == 0){*(timer_ptr+1) = 0xB; }
-    else if (strcmp(command, "run") == 0){*(timer_ptr+1) = 0x7;}
-    else if (strcmp(command, "disp") == 0){
-        disp = true;
-        *HEX_3_0_ptr = 0; *HEX_4_5_ptr = 0;
-        int digit0,digit1,digit2,digit3,digit4,digit5;
-        digit0 = ms %10; 		        //milliseconds first digit
-        digit1 = (ms %100)/10;		    //milliseconds second digit
-        digit2 = sec %10; 		        //seconds first digit
-        digit3 = (sec %100)/10;		    //seconds second digit
-        digit4 = min %10; 		        //min first digit
-        digit5 = (min %100)/10;		    //min second digit
-        *(HEX_3_0_ptr) = hex(digit0)| (hex(digit1)<<8) | (hex(digit2) << 16) | (hex(digit3) << 24);
-        *(HEX_4_5_ptr) = hex(digit4) | (hex(digit5) <<8);
-    }//set_time_display();}
-    else if (strcmp(command, "nodisp") == 0){disp = false; *HEX_3_0_ptr = 0; *HEX_4_5_ptr = 0;}
-    else if (sscanf(command, "%d:%d:%d", &min, &sec, &ms) == 3) {sprintf(stopwatch_msg, "%s", command);
-	time = 10000*min + 100*sec + ms;}
+	if (copy_from_user (msg, buffer, bytes) != 0)
+		return -EFAULT;
 
-	return bytes;
+    msg[bytes] = '\0';
+    if (sscanf (msg, "%63s", command) != 1)
+        return bytes;
+
+    //Check user input and perform actions on this stopwatch, tick, tickless,
+    //period and resolution change them all
+    write_seqlock_irqsave(&timer_lock, flags);
+    now = clock_now();
+    if (strcmp(command, "stop") == 0){sw_stop(sw, now);}
+    else if (strcmp(command, "run") == 0){sw_run(sw, now);}
+    else if (strcmp(command, "disp") == 0){sw_display(sw, true, now);}
+    else if (strcmp(command, "nodisp") == 0){sw_display(sw, false, now);}
+    else if (strcmp(command, "lap") == 0){lap_record(sw);}
+    else if (strcmp(command, "wait") == 0){f->wait = true;}
+    else if (strcmp(command, "nowait") == 0){f->wait = false;}
+    else if (strcmp(command, "noalarm") == 0){sw_alarm(sw, 0, now);}
+    else if (sscanf(msg, "alarm %15s", arg) == 1 && parse_time(arg, &left) == 0) {
+        sw_alarm(sw, left, now);
+    }
+    else if (strcmp(command, "tickless") == 0 || strcmp(command, "tick") == 0){
+        tickless = strcmp(command, "tickless") == 0;
+        if (disp_sw)
+            disp_set(disp_sw, now);
+        timer_reschedule(now);
+    }
+    else if (sscanf(msg, "period %d", &n) == 1){
+        if ((err = set_period(n)) == 0 && !tickless) timer_reschedule(now);
+    }
+    else if (sscanf(msg, "resolution %d", &n) == 1){err = set_resolution(n);}
+    else if (parse_time(command, &left) == 0) {
+	sw_set(sw, left, now);}
+    write_sequnlock_irqrestore(&timer_lock, flags);
+
+	return err < 0 ? err : bytes;
+}
+
+//Binary control, see stopwatch.h. Same actions as the write commands with
+//times in raw cycles, and GET reads the whole state without the lock
+static long stopwatch_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct stopwatch_file *f = filp->private_data;
+	struct stopwatch *sw = f->sw;
+	struct stopwatch_state state;
+	unsigned long flags;
+	unsigned seq;
+	u64 now, value = 0;
+
+	switch (cmd) {
+	case STOPWATCH_IOC_GET:
+		do {
+			seq = read_seqbegin(&timer_lock);
+			state.cycles = clock_peek();
+			state.left = sw_left(sw, state.cycles);
+			state.alarm = sw->alarm;
+			state.events = sw->events;
+			state.flags = (sw->running ? STOPWATCH_RUNNING : 0) |
+				(disp_sw == sw ? STOPWATCH_DISPLAYED : 0);
+		} while (read_seqretry(&timer_lock, seq));
+		if (copy_to_user((void __user *) arg, &state, sizeof(state)) != 0)
+			return -EFAULT;
+		return 0;
+	case STOPWATCH_IOC_SET:
+	case STOPWATCH_IOC_ALARM:
+		if (copy_from_user(&value, (void __user *) arg, sizeof(value)) != 0)
+			return -EFAULT;
+		if (value > STOPWATCH_MAX_LEFT)
+			return -EINVAL;
+		break;
+	case STOPWATCH_IOC_START:
+	case STOPWATCH_IOC_STOP:
+	case STOPWATCH_IOC_DISPLAY:
+	case STOPWATCH_IOC_LAP:
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	write_seqlock_irqsave(&timer_lock, flags);
+	now = clock_now();
+	switch (cmd) {
+	case STOPWATCH_IOC_START: sw_run(sw, now); break;
+	case STOPWATCH_IOC_STOP: sw_stop(sw, now); break;
+	case STOPWATCH_IOC_SET: sw_set(sw, value, now); break;
+	case STOPWATCH_IOC_ALARM: sw_alarm(sw, value, now); break;
+	case STOPWATCH_IOC_DISPLAY: sw_display(sw, arg != 0, now); break;
+	case STOPWATCH_IOC_LAP: lap_record(sw); break;
+	}
+	write_sequnlock_irqrestore(&timer_lock, flags);
+	return 0;
+}
+
+//Called to poll a stopwatch, readable once an alarm or expiry happened since
+//this file's last read
+static unsigned int stopwatch_poll(struct file *filp, poll_table *wait)
+{
+	struct stopwatch_file *f = filp->private_data;
+
+	poll_wait(filp, &f->sw->wait, wait);
+	return READ_ONCE(f->sw->events) != f->events ? POLLIN | POLLRDNORM : 0;
+}
+
+//Look at the oldest lap without taking it, false when there is none. *tail
+//says which one it was for lap_take()
+static bool lap_peek(struct stopwatch_lap *l, u32 *tail)
+{
+	unsigned int seq;
+	bool found;
+
+	do {
+		seq = read_seqbegin(&timer_lock);
+		*tail = lap_tail;
+		found = *tail != lap_head;
+		if (found)
+			*l = laps[*tail & (LAP_COUNT - 1)];
+	} while (read_seqretry(&timer_lock, seq));
+	return found;
+}
+
+//Take the lap lap_peek() returned off the ring, false when another reader
+//took it or it was overwritten first
+static bool lap_take(u32 tail)
+{
+	unsigned long flags;
+	bool found;
+
+	write_seqlock_irqsave(&timer_lock, flags);
+	found = lap_tail == tail;
+	if (found)
+		lap_tail++;
+	write_sequnlock_irqrestore(&timer_lock, flags);
+	return found;
+}
+
+//Called when a process reads from the laps device. Laps are handed out once,
+//as many whole ones as fit, in struct stopwatch_lap form once "binary" was written to
+//the file or else as a line of text each: seq, stopwatch, time left at the
+//resolution, cycle count. A lap that does not fit, or could not be copied,
+//stays for the next read, and a buffer too small for the first one is -EINVAL
+static ssize_t laps_read(struct file *filp, char *buffer, size_t length, loff_t *offset)
+{
+	bool binary = filp->private_data != NULL;
+	size_t sent = 0, bytes;
+	char line[64];
+	struct stopwatch_lap l;
+	int res_us, digits;
+	u32 tail;
+
+	if (binary && length < sizeof (l))
+		return -EINVAL;
+
+	while (lap_peek(&l, &tail)) {
+		if (binary) {
+			bytes = sizeof (l);
+			memcpy(line, &l, bytes);
+		} else {
+			bytes = sprintf(line, "%u %u ", l.seq, l.instance);
+			res_get(&res_us, &digits);
+			bytes += format_left(line + bytes, l.left, res_us, digits);
+			bytes += sprintf(line + bytes, " %llu\n", l.cycles);
+		}
+		if (bytes > length - sent) {
+			if (sent == 0)
+				return -EINVAL;
+			break;
+		}
+		//Copy before taking so a fault leaves the lap on the ring. One that
+		//was taken or overwritten meanwhile is written over by the next
+		if (copy_to_user (buffer + sent, line, bytes) != 0)
+			return sent ? sent : -EFAULT;
+		if (!lap_take(tail))
+			continue;
+		sent += bytes;
+	}
+	return sent;
+}
+
+//Called when a process writes to the laps device, "binary" or "text" picks
+//the format reads from this file return
+static ssize_t laps_write(struct file *filp, const char *buffer, size_t length, loff_t *offset)
+{
+	char command[8];
+
+	//The whole write is the word, a trailing newline aside
+	if (length > sizeof (command) - 1)
+		return -EINVAL;
+	if (copy_from_user (command, buffer, length) != 0)
+		return -EFAULT;
+	command[length] = '\0';
+	if (length && command[length - 1] == '\n')
+		command[length - 1] = '\0';
+
+	if (strcmp(command, "binary") == 0)
+		filp->private_data = (void *) 1;
+	else if (strcmp(command, "text") == 0)
+		filp->private_data = NULL;
+	else
+		return -EINVAL;
+	return length;
 }
 
 MODULE_LICENSE("GPL");
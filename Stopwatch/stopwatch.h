@@ -0,0 +1,102 @@
+#ifndef STOPWATCH_STOPWATCH_H_
+#define STOPWATCH_STOPWATCH_H_
+
+/* Interface shared between the stopwatch driver and user-space programs.
+ *
+ * Each stopwatch counts down from the time it was set to, in cycles of the
+ * 100 MHz interval timer. /dev/stopwatch is the first one, /dev/stopwatch1 and
+ * up the others when the module is loaded with instances=.
+ *
+ * Text interface: read() returns the time left as MM:SS:F, F having as many
+ * digits as the resolution takes (MM:SS:CC by default). Each time is read to
+ * its end, where read() returns 0 and rewinds, so the next read() returns a
+ * new one; lseek() to 0 also starts over. write() takes one
+ * command: "stop", "run", "MM:SS:F" to set, "disp" and "nodisp", "lap",
+ * "alarm MM:SS:F" and "noalarm", "wait" and "nowait", and for all stopwatches
+ * "tick", "tickless", "period N" and "resolution N" (microseconds); a period
+ * or resolution out of range is -EINVAL. F has up to as many digits as the
+ * resolution, one or two being hundredths.
+ *
+ * ioctl interface: the same control with fixed structs and no parsing, times
+ * in raw cycles. STOPWATCH_IOC_GET returns the state in one call:
+ *
+ *   struct stopwatch_state st;
+ *   uint64_t left = 90 * STOPWATCH_HZ;
+ *   ioctl(fd, STOPWATCH_IOC_SET, &left);
+ *   ioctl(fd, STOPWATCH_IOC_START);
+ *   ioctl(fd, STOPWATCH_IOC_GET, &st);
+ *
+ * Expiry: the stopwatch counts an event when its countdown reaches zero or
+ * passes its alarm. poll() reports the file readable once an event happened
+ * since the file's last read(), and after "wait" read() blocks until then.
+ *
+ * Laps: "lap", STOPWATCH_IOC_LAP or KEY0 (lap_key=1) record the cycle count in
+ * a ring of STOPWATCH_LAPS entries. /dev/stopwatch_laps hands each out once, as
+ * a line of text or, after "binary" is written to the open file, as a struct
+ * stopwatch_lap.
+ *
+ * Events: starts, stops, sets, laps, alarms and expiries are logged with the
+ * cycle count and the CLOCK_MONOTONIC time, the clock of perf and of ftrace's
+ * "mono" trace clock, and are each also a tracepoint (stopwatch:stopwatch_*).
+ * stopwatch/events in debugfs reads the last STOPWATCH_EVENTS of them as struct
+ * stopwatch_event, from where the file offset left off. Reading never blocks
+ * the driver, and a gap in seq shows how many were overwritten first.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#else
+#include <stdint.h>
+#include <sys/ioctl.h>
+#endif
+
+#define STOPWATCH_HZ            100000000   // timer cycles per second
+#define STOPWATCH_MAX_LEFT      ((uint64_t) 599999 * 1000000)   // 99:59:99
+#define STOPWATCH_LAPS          64
+
+#define STOPWATCH_RUNNING       0x1     // counting down, cleared by stop
+#define STOPWATCH_DISPLAYED     0x2     // shown on the seven segment display
+
+struct stopwatch_state {
+    uint64_t cycles;            // cycle count the state was taken at
+    uint64_t left;              // cycles left on the countdown
+    uint64_t alarm;             // alarm threshold in cycles left, 0 for none
+    uint32_t events;            // alarms and expiries so far
+    uint32_t flags;             // STOPWATCH_RUNNING, STOPWATCH_DISPLAYED
+};
+
+struct stopwatch_lap {
+    uint64_t cycles;            // cycle count when the lap was taken
+    uint64_t left;              // cycles left on the stopwatch at that moment
+    uint32_t seq;               // number of laps taken before this one
+    uint32_t instance;          // stopwatch the lap was taken on
+};
+
+#define STOPWATCH_EVENTS        256
+#define STOPWATCH_EV_START      1
+#define STOPWATCH_EV_STOP       2
+#define STOPWATCH_EV_SET        3
+#define STOPWATCH_EV_LAP        4
+#define STOPWATCH_EV_ALARM      5
+#define STOPWATCH_EV_EXPIRE     6
+
+struct stopwatch_event {
+    uint64_t cycles;            // cycle count the event happened at
+    uint64_t ns;                // CLOCK_MONOTONIC time at that moment
+    uint64_t left;              // cycles left on the stopwatch after it
+    uint32_t seq;               // number of events logged before this one
+    uint16_t type;              // STOPWATCH_EV_*
+    uint16_t instance;          // stopwatch it happened on
+};
+
+#define STOPWATCH_IOC_MAGIC     's'
+#define STOPWATCH_IOC_START     _IO(STOPWATCH_IOC_MAGIC, 1)
+#define STOPWATCH_IOC_STOP      _IO(STOPWATCH_IOC_MAGIC, 2)
+#define STOPWATCH_IOC_SET       _IOW(STOPWATCH_IOC_MAGIC, 3, uint64_t)  // cycles left
+#define STOPWATCH_IOC_GET       _IOR(STOPWATCH_IOC_MAGIC, 4, struct stopwatch_state)
+#define STOPWATCH_IOC_DISPLAY   _IO(STOPWATCH_IOC_MAGIC, 5)     // arg 1 shows, 0 turns off
+#define STOPWATCH_IOC_ALARM     _IOW(STOPWATCH_IOC_MAGIC, 6, uint64_t)  // 0 clears it
+#define STOPWATCH_IOC_LAP       _IO(STOPWATCH_IOC_MAGIC, 7)
+
+#endif /*STOPWATCH_STOPWATCH_H_*/
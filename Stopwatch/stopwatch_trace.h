@@ -0,0 +1,55 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM stopwatch
+
+#if !defined(STOPWATCH_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define STOPWATCH_TRACE_H_
+
+/* Tracepoints for the stopwatch event log, one per event type so each can be
+ * enabled and filtered on its own. They carry the logged entry as is, so a
+ * capture lines up with stopwatch/events by seq. */
+
+#include <linux/tracepoint.h>
+#include "stopwatch.h"
+
+DECLARE_EVENT_CLASS(stopwatch_event,
+	TP_PROTO(const struct stopwatch_event *e),
+	TP_ARGS(e),
+	TP_STRUCT__entry(
+		__field(u64, cycles)
+		__field(u64, ns)
+		__field(u64, left)
+		__field(u32, seq)
+		__field(u16, instance)
+	),
+	TP_fast_assign(
+		__entry->cycles = e->cycles;
+		__entry->ns = e->ns;
+		__entry->left = e->left;
+		__entry->seq = e->seq;
+		__entry->instance = e->instance;
+	),
+	TP_printk("instance=%u seq=%u cycles=%llu ns=%llu left=%llu",
+		__entry->instance, __entry->seq, __entry->cycles, __entry->ns, __entry->left)
+);
+
+DEFINE_EVENT(stopwatch_event, stopwatch_start,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+DEFINE_EVENT(stopwatch_event, stopwatch_stop,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+DEFINE_EVENT(stopwatch_event, stopwatch_set,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+DEFINE_EVENT(stopwatch_event, stopwatch_lap,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+DEFINE_EVENT(stopwatch_event, stopwatch_alarm,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+DEFINE_EVENT(stopwatch_event, stopwatch_expire,
+	TP_PROTO(const struct stopwatch_event *e), TP_ARGS(e));
+
+#endif /*STOPWATCH_TRACE_H_*/
+
+// Outside the guard, define_trace.h reads this file again
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE stopwatch_trace
+#include <trace/define_trace.h>